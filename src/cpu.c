@@ -58,16 +58,76 @@ int write(
 	return write_mem(proc->regs[destination] + offset, proc, data);
 }
 
-int run(struct pcb_t *proc)
-{
-	/* Check if Program Counter point to the proper instruction */
-	if (proc->pc >= proc->code->size)
+int readn(
+	struct pcb_t *proc, // Process executing the instruction
+	uint32_t source,	// Index of source register
+	uint32_t offset,	// Source address = [source] + [offset]
+	uint32_t size)
+{ // Number of bytes to read
+	BYTE data;
+	uint32_t i;
+	for (i = 0; i < size; i++)
 	{
-		return 1;
+		if (read_mem(proc->regs[source] + offset + i, proc, &data))
+		{
+			return 1;
+		}
 	}
+	return 0;
+}
 
-	struct inst_t ins = proc->code->text[proc->pc];
-	proc->pc++;
+int memset_data(
+	struct pcb_t *proc,	// Process executing the instruction
+	BYTE data,		// Byte to fill the range with
+	uint32_t destination, // Index of destination register
+	uint32_t offset,	// Destination address = [destination] + [offset]
+	uint32_t size)
+{ // Number of bytes to fill
+	uint32_t i;
+	for (i = 0; i < size; i++)
+	{
+		if (write_mem(proc->regs[destination] + offset + i, proc, data))
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int memcpy_data(
+	struct pcb_t *proc,	// Process executing the instruction
+	uint32_t source,	// Index of source register
+	uint32_t destination, // Index of destination register
+	uint32_t size)
+{ // Number of bytes to copy from [source] to [destination]
+	BYTE data;
+	uint32_t i;
+	for (i = 0; i < size; i++)
+	{
+		if (read_mem(proc->regs[source] + i, proc, &data) ||
+		    write_mem(proc->regs[destination] + i, proc, data))
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int run(struct pcb_t *proc)
+{
+	/* Check if Program Counter point to the proper instruction. killall
+	 * may move it to the end from another CPU, so it is checked and
+	 * advanced in one atomic step */
+	uint32_t pc = __atomic_load_n(&proc->pc, __ATOMIC_RELAXED);
+	do {
+		if (pc >= proc->code->size)
+		{
+			return 1;
+		}
+	} while (!__atomic_compare_exchange_n(&proc->pc, &pc, pc + 1, 0,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	struct inst_t ins = proc->code->text[pc];
 	int stat = 1;
 switch (ins.opcode)
 	{
@@ -100,6 +160,27 @@ switch (ins.opcode)
 		stat = libwrite(proc, ins.arg_0, ins.arg_1, ins.arg_2);
 #else
 		stat = write(proc, ins.arg_0, ins.arg_1, ins.arg_2);
+#endif
+		break;
+	case READN:
+#ifdef MM_PAGING
+		stat = libreadn(proc, ins.arg_0, ins.arg_1, ins.arg_2);
+#else
+		stat = readn(proc, ins.arg_0, ins.arg_1, ins.arg_2);
+#endif
+		break;
+	case MEMSET:
+#ifdef MM_PAGING
+		stat = libmemset(proc, ins.arg_0, ins.arg_1, ins.arg_2, ins.arg_3);
+#else
+		stat = memset_data(proc, ins.arg_0, ins.arg_1, ins.arg_2, ins.arg_3);
+#endif
+		break;
+	case MEMCPY:
+#ifdef MM_PAGING
+		stat = libmemcpy(proc, ins.arg_0, ins.arg_1, ins.arg_2);
+#else
+		stat = memcpy_data(proc, ins.arg_0, ins.arg_1, ins.arg_2);
 #endif
 		break;
 	case SYSCALL:
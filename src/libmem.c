@@ -22,7 +22,12 @@
 #include <stdio.h>
 #include <pthread.h>
 
-static pthread_mutex_t mmvm_lock = PTHREAD_MUTEX_INITIALIZER;
+/*
+ * Mỗi mm_struct có khoá riêng (mm->lock) bảo vệ VMA, danh sách vùng trống,
+ * bảng ký hiệu và bảng trang của tiến trình đó; các kho frame dùng chung
+ * (mram, mswp) tự khoá bên trong MEMPHY. CPU chạy các tiến trình khác nhau
+ * vì vậy không còn phải chờ nhau ở các lệnh bộ nhớ.
+ */
 
 /*enlist_vm_freerg_list - add new rg to freerg_list
  *@mm: memory region
@@ -98,7 +103,7 @@ struct vm_rg_struct *get_symrg_byid(struct mm_struct *mm, int rgid)
 int __alloc(struct pcb_t *caller, int vmaid, int rgid, int size, int *alloc_addr)
 {
   /* Bảo vệ vùng nhớ dùng mutex */
-  pthread_mutex_lock(&mmvm_lock);
+  pthread_mutex_lock(&caller->mm->lock);
 
   struct vm_rg_struct rgnode;
 
@@ -118,14 +123,14 @@ int __alloc(struct pcb_t *caller, int vmaid, int rgid, int size, int *alloc_addr
 #ifdef PAGETBL_DUMP
   print_pgtbl(caller, 0, -1); //print max TBL
 #endif
-    pthread_mutex_unlock(&mmvm_lock);
+    pthread_mutex_unlock(&caller->mm->lock);
     return 0;
   }
 
   // Không đủ vùng nhớ, gọi syscall để mở rộng heap
   struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
   if (cur_vma == NULL) {
-    pthread_mutex_unlock(&mmvm_lock);
+    pthread_mutex_unlock(&caller->mm->lock);
     return -1;
   }
 
@@ -142,7 +147,7 @@ int __alloc(struct pcb_t *caller, int vmaid, int rgid, int size, int *alloc_addr
   {
     cur_vma->vm_end = old_end;
     cur_vma->sbrk = old_sbrk;
-    pthread_mutex_unlock(&mmvm_lock);
+    pthread_mutex_unlock(&caller->mm->lock);
     return -1;
   }
 
@@ -159,7 +164,8 @@ int __alloc(struct pcb_t *caller, int vmaid, int rgid, int size, int *alloc_addr
   new_free_rg->rg_end = cur_vma->sbrk;
   new_free_rg->rg_next = NULL;
 
-  enlist_vm_freerg_list(caller->mm, new_free_rg); // Đưa vào danh sách vùng nhớ trống
+  if (enlist_vm_freerg_list(caller->mm, new_free_rg) == -1) // Đưa vào danh sách vùng nhớ trống
+    free(new_free_rg); // Không còn dư byte nào thì bỏ nút rỗng
 
 #ifdef DEBUG
     printf("=========== PHYSICAL MEMORY AFTER (SYSCALL) ALLOCATION ===========\n");
@@ -169,7 +175,7 @@ int __alloc(struct pcb_t *caller, int vmaid, int rgid, int size, int *alloc_addr
 #endif
 #endif
 
-  pthread_mutex_unlock(&mmvm_lock);
+  pthread_mutex_unlock(&caller->mm->lock);
   return 0;
 }
 
@@ -182,11 +188,11 @@ int __alloc(struct pcb_t *caller, int vmaid, int rgid, int size, int *alloc_addr
  */
 int __free(struct pcb_t *caller, int vmaid, int rgid)
 {
-  pthread_mutex_lock(&mmvm_lock);
+  pthread_mutex_lock(&caller->mm->lock);
 
   // Kiểm tra chỉ số hợp lệ
   if(rgid < 0 || rgid > PAGING_MAX_SYMTBL_SZ){
-    pthread_mutex_unlock(&mmvm_lock);
+    pthread_mutex_unlock(&caller->mm->lock);
     return -1;
   }
   
@@ -233,7 +239,8 @@ int __free(struct pcb_t *caller, int vmaid, int rgid)
 
   // Thêm vùng nhớ đã gộp vào danh sách vùng nhớ trống
   if(enlist_vm_freerg_list(caller->mm, new_frrg) == -1) {
-    pthread_mutex_unlock(&mmvm_lock);
+    free(new_frrg);
+    pthread_mutex_unlock(&caller->mm->lock);
     return -1;
   }
   
@@ -250,7 +257,7 @@ int __free(struct pcb_t *caller, int vmaid, int rgid)
 #endif
 #endif
 
-  pthread_mutex_unlock(&mmvm_lock);
+  pthread_mutex_unlock(&caller->mm->lock);
   return 0;
 }
 
@@ -281,58 +288,212 @@ int libfree(struct pcb_t *proc, uint32_t reg_index)
   return __free(proc, 0, reg_index);
 }
 
-/*pg_getpage - get the page in ram
- *@mm: memory region
- *@pagenum: PGN
- *@framenum: return FPN
+/*__evict_page - free a RAM frame by moving a victim page out to swap
+ *@mm: faulting memory region, locked by the caller
  *@caller: caller
+ *@retfpn: return the freed FPN
  */
-int pg_getpage(struct mm_struct *mm, int pgn, int *fpn, struct pcb_t *caller)
+static int __evict_page(struct mm_struct *mm, struct pcb_t *caller, int *retfpn)
 {
-  uint32_t pte = mm->pgd[pgn];
+  struct mm_struct *vicmm;
+  int vicpgn, swpfpn, vicfpn, swptyp, wrback, newslot = 0;
 
-  /* Nếu trang chưa được load vào RAM */
-  if (!PAGING_PAGE_PRESENT(pte))
-  {
-    int vicpgn, swpfpn, vicfpn;
-    uint32_t vicpte;
+  /* Chính sách thay trang đang chọn quyết định nạn nhân; với chính sách
+   * global nạn nhân có thể thuộc process khác, khi đó vicmm đã được khoá */
+  if (pgrep_select(mm, &vicmm, &vicpgn, &vicfpn) == -1) return -1;
 
-    /* Tìm trang nạn nhân để thay thế (victim page) */
-    find_victim_page(caller->mm, &vicpgn);
-    vicpte = mm->pgd[vicpgn];
-    vicfpn = PAGING_PTE_FPN(vicpte);
+  /* Trang sạch còn bản sao đúng trong swap thì không cần chép lại;
+   * trang bẩn có sẵn slot thì ghi đè lên slot đó */
+  wrback = pgrep_swap_slot(vicfpn, pte_get(vicmm, vicpgn) & PAGING_PTE_DIRTY_MASK,
+                           &swptyp, &swpfpn);
 
-    /* Tìm frame trống trong bộ nhớ swap */
-    if(MEMPHY_get_freefp(caller->active_mswp, &swpfpn) == -1) return -1;
+  /* Chưa có slot: bộ quản lý swap cấp frame trống, luân phiên giữa các thiết bị swap */
+  if (swpfpn == -1)
+  {
+    if(swp_get_slot(&swptyp, &swpfpn) == -1)
+    {
+      pgrep_add(vicmm, vicpgn, vicfpn); // Trả nạn nhân về danh sách, nó vẫn nằm trong RAM
+      if (vicmm != mm) pthread_mutex_unlock(&vicmm->lock);
+      return -1;
+    }
+    newslot = 1;
+  }
 
-    /* Gọi syscall để sao chép trang nạn nhân từ RAM -> SWAP */
+  /* Gọi syscall để sao chép trang nạn nhân từ RAM -> SWAP */
+  if (wrback)
+  {
     struct sc_regs regs;
     regs.a1 = SYSMEM_SWP_OP;
     regs.a2 = vicfpn;
     regs.a3 = swpfpn;
-    if(syscall(caller, 17, &regs) == -1) return -1;
+    regs.a4 = swptyp;
+    if(syscall(caller, 17, &regs) == -1)
+    {
+      if (newslot) swp_put_slot(swptyp, swpfpn);
+      pgrep_add(vicmm, vicpgn, vicfpn);
+      if (vicmm != mm) pthread_mutex_unlock(&vicmm->lock);
+      return -1;
+    }
+  }
 
-    /* Cập nhật lại PTE của victim page, chuyển sang trạng thái swap */
-    pte_set_swap(&mm->pgd[vicpgn], caller->active_mswp_id, swpfpn);
+  /* Cập nhật lại PTE của victim page, chuyển sang trạng thái swap */
+  pte_set_swap(pte_lookup(vicmm, vicpgn), swptyp, swpfpn);
+  tlb_invalidate(vicmm, vicpgn);
+  if (vicmm != mm) pthread_mutex_unlock(&vicmm->lock);
 
-    /* Lấy frame vật lý đang chứa dữ liệu của trang cần nạp */
-    int tgtfpn = PAGING_PTE_SWP(pte);
+  *retfpn = vicfpn;
+  return 0;
+}
 
-    /* Copy từ swap vào frame trống (là frame victim vừa bị thay thế) */
-    if(__swap_cp_page(caller->active_mswp, tgtfpn, caller->mram, vicfpn) == -1) return -1;
+/*alloc_ram_frame - get a free RAM frame, reclaiming pages to swap if needed
+ *@caller: caller, its mm is locked
+ *@retfpn: return FPN
+ */
+int alloc_ram_frame(struct pcb_t *caller, int *retfpn)
+{
+  int low, high, target, nfree, nrec = 0, fpn;
 
-    /* Cập nhật PTE cho trang đích, đánh dấu đã có mặt trong RAM */
-    pte_set_fpn(&mm->pgd[pgn], vicfpn);
+  pgrep_get_wmark(&low, &high);
+  nfree = MEMPHY_get_nfree(caller->mram);
+
+  /* Chạm ngưỡng thấp: CPU đang lỗi trang phải tự thay trang ra swap
+   * (direct reclaim) cho tới ngưỡng cao rồi mới được cấp frame */
+  if (nfree <= low)
+  {
+    target = (high > low) ? high : low + 1;
+    while (nfree < target && nrec < target)
+    {
+      if (__evict_page(caller->mm, caller, &fpn) == -1) break;
+      MEMPHY_put_freefp(caller->mram, fpn);
+      nfree++;
+      nrec++;
+    }
+    pgrep_stall(nrec);
   }
 
-  /* Thêm trang này vào danh sách FIFO của tiến trình */
-  enlist_pgn_node(&caller->mm->fifo_pgn, pgn);
+  if (MEMPHY_get_freefp(caller->mram, retfpn) == 0)
+    return 0;
+
+  /* CPU khác đã lấy mất frame vừa thu hồi: thay thêm một trang và dùng luôn frame đó */
+  return __evict_page(caller->mm, caller, retfpn);
+}
+
+/*__pgn_in_vma - check that a page lies inside one of the vm areas of mm
+ *@mm: memory region
+ *@pgn: PGN
+ */
+static int __pgn_in_vma(struct mm_struct *mm, int pgn)
+{
+  struct vm_area_struct *vma;
+  unsigned long addr = (unsigned long)pgn * PAGING_PAGESZ;
+
+  for (vma = mm->mmap; vma != NULL; vma = vma->vm_next)
+    if (addr >= vma->vm_start && addr < vma->vm_end)
+      return 1;
+
+  return 0;
+}
+
+/*__pg_getpte - get the page in ram and its PTE
+ *@mm: memory region
+ *@pagenum: PGN
+ *@framenum: return FPN
+ *@caller: caller
+ *@retpte: return the PTE of the page
+ */
+static int __pg_getpte(struct mm_struct *mm, int pgn, int *fpn, struct pcb_t *caller,
+                       uint32_t **retpte)
+{
+  uint32_t *ptep;
+
+  /* Trang vừa dùng gần đây: TLB cho luôn frame và PTE, bỏ qua bảng trang.
+   * Bit referenced vẫn phải bật để CLOCK/LRU thấy trang đang được dùng */
+  if (tlb_lookup(mm, pgn, fpn, &ptep) == 0)
+  {
+    SETBIT(*ptep, PAGING_PTE_REFER_MASK);
+    *retpte = ptep;
+    return 0;
+  }
+
+  /* Bảng lá chưa được cấp nghĩa là mọi PTE trong đó đều rỗng */
+  ptep = pte_lookup(mm, pgn);
+  uint32_t pte = (ptep != NULL) ? *ptep : 0;
+
+  /* Trang không nằm trong RAM: chưa từng được chạm tới (PTE rỗng) hoặc đang
+   * nằm ở swap (PTE của trang bị swap vẫn bật bit present nên xét thêm bit swapped) */
+  if (!PAGING_PAGE_PRESENT(pte) || (pte & PAGING_PTE_SWAPPED_MASK))
+  {
+    int swapped = (pte & PAGING_PTE_SWAPPED_MASK) != 0;
+    int newfpn;
+
+    /* Trang chưa từng chạm tới chỉ hợp lệ nếu nằm trong vùng heap đã nới */
+    if (!swapped && !__pgn_in_vma(mm, pgn)) return -1;
+    if (ptep == NULL && (ptep = pte_alloc(mm, pgn)) == NULL) return -1;
+
+    /* Ưu tiên frame còn trống trong RAM, dưới ngưỡng thì thu hồi trang trước */
+    if (alloc_ram_frame(caller, &newfpn) == -1)
+      return -1;
+
+    if (swapped)
+    {
+      /* Lỗi trang lớn: lấy thiết bị swap (trường swap type) và frame đang chứa dữ liệu */
+      int tgttyp = GETVAL(pte, PAGING_PTE_SWPTYP_MASK, PAGING_PTE_SWPTYP_LOBIT);
+      int tgtfpn = PAGING_PTE_SWP(pte);
+      struct memphy_struct *tgtswp = swp_get_dev(tgttyp);
+
+      if(tgtswp == NULL || __swap_cp_page(tgtswp, tgtfpn, caller->mram, newfpn) == -1)
+      {
+        MEMPHY_put_freefp(caller->mram, newfpn);
+        return -1;
+      }
+
+      /* Trang vừa nạp trùng với bản trong swap nên còn sạch và giữ lại slot đó */
+      pgrep_set_swap(newfpn, tgttyp, tgtfpn);
+    }
+    else
+    {
+      /* Lỗi trang nhỏ: cấp phát lười, frame mới được xoá trắng ở lần chạm đầu tiên */
+      static const BYTE zero_page[PAGING_PAGESZ];
+
+      if (MEMPHY_write_page(caller->mram, newfpn, zero_page) == -1)
+      {
+        MEMPHY_put_freefp(caller->mram, newfpn);
+        return -1;
+      }
+      pgrep_set_swap(newfpn, 0, -1);
+    }
+    pgrep_fault(!swapped);
+
+    /* Cập nhật PTE cho trang đích, đánh dấu đã có mặt trong RAM */
+    pte_set_fpn(ptep, newfpn);
+    CLRBIT(*ptep, PAGING_PTE_DIRTY_MASK);
+
+    /* Trang vừa nạp là trang mới nhất trong danh sách; các lần truy cập sau
+     * không thêm nút nào nữa, mỗi trang có mặt chỉ nằm trong đó một lần */
+    pgrep_add(mm, pgn, newfpn);
+  }
 
   /* Trả về frame number đã cấp phát */
-  *fpn = PAGING_FPN(mm->pgd[pgn]);
+  SETBIT(*ptep, PAGING_PTE_REFER_MASK);
+  *fpn = PAGING_PTE_FPN(*ptep);
+  tlb_insert(mm, pgn, *fpn, ptep);
+  *retpte = ptep;
   return 0;
 }
 
+/*pg_getpage - get the page in ram
+ *@mm: memory region
+ *@pagenum: PGN
+ *@framenum: return FPN
+ *@caller: caller
+ */
+int pg_getpage(struct mm_struct *mm, int pgn, int *fpn, struct pcb_t *caller)
+{
+  uint32_t *pte;
+
+  return __pg_getpte(mm, pgn, fpn, caller, &pte);
+}
+
 /*pg_getval - read value at given offset
  *@mm: memory region
  *@addr: virtual address to acess
@@ -350,14 +511,9 @@ int pg_getval(struct mm_struct *mm, int addr, BYTE *data, struct pcb_t *caller)
 
   int phyaddr = fpn * PAGING_PAGESZ + offs;  // Tính địa chỉ vật lý
 
-  // Gọi syscall để đọc dữ liệu từ RAM tại địa chỉ vật lý
-  struct sc_regs regs;
-  regs.a1 = SYSMEM_IO_READ;
-  regs.a2 = phyaddr;
-
-  if(syscall(caller, 17, &regs) == -1) return -1; // Đọc thất bại
-
-  *data = regs.a3;  // Gán dữ liệu đọc được vào biến data
+  // Thư viện tin cậy đọc thẳng frame trong RAM, không đi vòng qua syscall 17
+  // (lệnh SYSCALL 17 do chương trình phát ra vẫn đi qua __sys_memmap)
+  if (MEMPHY_read(caller->mram, phyaddr, data) == -1) return -1; // Đọc thất bại
 
   return 0;
 }
@@ -374,19 +530,18 @@ int pg_getval(struct mm_struct *mm, int addr, BYTE *data, struct pcb_t *caller)
    int pgn = PAGING_PGN(addr);     // Tính chỉ số trang từ địa chỉ ảo
    int offs = PAGING_OFFST(addr);  // Tính offset trong trang
    int fpn;
+   uint32_t *pte;
  
    // Đảm bảo trang đã có trong RAM (swap in nếu cần)
-   if (pg_getpage(mm, pgn, &fpn, caller) == -1) return -1; // Truy cập trang không hợp lệ
+   if (__pg_getpte(mm, pgn, &fpn, caller, &pte) == -1) return -1; // Truy cập trang không hợp lệ
  
    int phyaddr = fpn * PAGING_PAGESZ + offs;  // Tính địa chỉ vật lý tương ứng
  
-   // Gọi syscall để ghi dữ liệu vào RAM tại địa chỉ vật lý
-   struct sc_regs regs;
-   regs.a1 = SYSMEM_IO_WRITE;
-   regs.a2 = phyaddr;
-   regs.a3 = value;
- 
-   if(syscall(caller, 17, &regs) == -1) return -1; // Ghi thất bại
+   // Ghi thẳng vào frame trong RAM, không đi vòng qua syscall 17
+   if (MEMPHY_write(caller->mram, phyaddr, value) == -1) return -1; // Ghi thất bại
+
+   // Trang đã khác bản sao trong swap, khi bị thay phải ghi lại
+   SETBIT(*pte, PAGING_PTE_DIRTY_MASK);
  
    return 0;
  }
@@ -402,18 +557,22 @@ int pg_getval(struct mm_struct *mm, int addr, BYTE *data, struct pcb_t *caller)
  */
 int __read(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE *data)
 {
-  pthread_mutex_lock(&mmvm_lock);
+  pthread_mutex_lock(&caller->mm->lock);
   struct vm_rg_struct *currg = get_symrg_byid(caller->mm, rgid);
   struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
 
   if (currg == NULL || cur_vma == NULL) /* Invalid memory identify */
+  {
+    pthread_mutex_unlock(&caller->mm->lock);
     return -1;
+  }
 
-  pg_getval(caller->mm, currg->rg_start + offset, data, caller);
+  // Trang không đưa được vào RAM (hết RAM lẫn swap) thì báo lỗi, không trả dữ liệu rác
+  int ret = pg_getval(caller->mm, currg->rg_start + offset, data, caller);
 
-  pthread_mutex_unlock(&mmvm_lock);
+  pthread_mutex_unlock(&caller->mm->lock);
 
-  return 0;
+  return ret;
 }
 
 /*libread - PAGING-based read a region memory */
@@ -425,6 +584,8 @@ int libread(
 {
   BYTE data;
   int val = __read(proc, 0, source, offset, &data);
+  if (val != 0)
+    return val; // Đọc thất bại thì giữ nguyên thanh ghi đích
 
   /* TODO update result of reading action*/
   //destination
@@ -453,16 +614,19 @@ int libread(
  */
 int __write(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE value)
 {
-  pthread_mutex_lock(&mmvm_lock);
+  pthread_mutex_lock(&caller->mm->lock);
   struct vm_rg_struct *currg = get_symrg_byid(caller->mm, rgid);
   struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
 
   if (currg == NULL || cur_vma == NULL) /* Invalid memory identify */
+  {
+    pthread_mutex_unlock(&caller->mm->lock);
     return -1;
+  }
 
-  pg_setval(caller->mm, currg->rg_start + offset, value, caller);
-  pthread_mutex_unlock(&mmvm_lock);
-  return 0;
+  int ret = pg_setval(caller->mm, currg->rg_start + offset, value, caller);
+  pthread_mutex_unlock(&caller->mm->lock);
+  return ret;
 }
 
 /*libwrite - PAGING-based write a region memory */
@@ -487,71 +651,213 @@ int libwrite(
   return val;
 }
 
-/*free_pcb_memphy - collect all memphy of pcb
+/* Kiểu thao tác của __rw_range */
+#define RANGE_READ  0
+#define RANGE_WRITE 1
+#define RANGE_FILL  2
+
+/*__rw_range - move a byte range of a region memory, one page span at a time
  *@caller: caller
  *@vmaid: ID vm area to alloc memory region
- *@incpgnum: number of page
+ *@rgid: memory region ID (used to identify variable in symbole table)
+ *@offset: offset of the first byte in the region
+ *@buf: destination (RANGE_READ), source (RANGE_WRITE) or fill byte (RANGE_FILL)
+ *@size: number of bytes
+ *@op: RANGE_READ, RANGE_WRITE or RANGE_FILL
  */
-int free_pcb_memph(struct pcb_t *caller)
+static int __rw_range(struct pcb_t *caller, int vmaid, int rgid, int offset,
+                      BYTE *buf, int size, int op)
 {
-  int pagenum, fpn;
-  uint32_t pte;
+  BYTE fill[PAGING_PAGESZ];
+  int done = 0, ret = 0;
+
+  pthread_mutex_lock(&caller->mm->lock);
+  struct vm_rg_struct *currg = get_symrg_byid(caller->mm, rgid);
+  struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
+
+  // Vùng không hợp lệ hoặc đoạn cần truy cập vượt ra ngoài vùng
+  if (currg == NULL || cur_vma == NULL || offset < 0 || size < 0 ||
+      currg->rg_start + offset + size > currg->rg_end)
+  {
+    pthread_mutex_unlock(&caller->mm->lock);
+    return -1;
+  }
 
+  if (op == RANGE_FILL)
+    memset(fill, buf[0], sizeof(fill));
 
-  for(pagenum = 0; pagenum < PAGING_MAX_PGN; pagenum++)
+  // Mỗi trang chỉ dịch địa chỉ một lần, rồi chép nguyên phần nằm trong trang đó
+  while (done < size)
   {
-    pte= caller->mm->pgd[pagenum];
+    int addr = currg->rg_start + offset + done;
+    int offs = PAGING_OFFST(addr);
+    int len = PAGING_PAGESZ - offs;
+    int fpn;
+    uint32_t *pte;
 
-    if (!PAGING_PAGE_PRESENT(pte))
+    if (len > size - done)
+      len = size - done;
+
+    if (__pg_getpte(caller->mm, PAGING_PGN(addr), &fpn, caller, &pte) == -1)
     {
-      fpn = PAGING_PTE_FPN(pte);
-      MEMPHY_put_freefp(caller->mram, fpn);
-    } else {
-      fpn = PAGING_PTE_SWP(pte);
-      MEMPHY_put_freefp(caller->active_mswp, fpn);    
+      ret = -1;
+      break;
     }
+
+    int phyaddr = fpn * PAGING_PAGESZ + offs;
+    if (op == RANGE_READ)
+      ret = MEMPHY_read_range(caller->mram, phyaddr, buf + done, len);
+    else
+    {
+      ret = MEMPHY_write_range(caller->mram, phyaddr,
+                               (op == RANGE_FILL) ? fill : buf + done, len);
+      SETBIT(*pte, PAGING_PTE_DIRTY_MASK);
+    }
+    if (ret != 0)
+      break;
+
+    done += len;
   }
 
-  return 0;
+  pthread_mutex_unlock(&caller->mm->lock);
+  return ret;
+}
+
+#ifdef IODUMP
+/* Phần in chung sau mỗi lệnh vào/ra khối */
+static void __range_dump(struct pcb_t *proc)
+{
+#ifdef PAGETBL_DUMP
+  print_pgtbl(proc, 0, -1); //print max TBL
+#endif
+  MEMPHY_dump(proc->mram);
+}
+#endif
+
+/*libread_range - PAGING-based read a byte range of a region memory
+ *@proc: Process executing the instruction
+ *@source: memory region ID to read from
+ *@offset: offset of the first byte in the region
+ *@buf: buffer of size bytes
+ *@size: number of bytes
+ */
+int libread_range(struct pcb_t *proc, uint32_t source, uint32_t offset,
+                  BYTE *buf, uint32_t size)
+{
+  return __rw_range(proc, 0, source, offset, buf, size, RANGE_READ);
+}
+
+/*libwrite_range - PAGING-based write a byte range of a region memory
+ *@proc: Process executing the instruction
+ *@buf: buffer of size bytes
+ *@destination: memory region ID to write to
+ *@offset: offset of the first byte in the region
+ *@size: number of bytes
+ */
+int libwrite_range(struct pcb_t *proc, const BYTE *buf, uint32_t destination,
+                   uint32_t offset, uint32_t size)
+{
+  return __rw_range(proc, 0, destination, offset, (BYTE *)buf, size, RANGE_WRITE);
+}
+
+/*libreadn - PAGING-based read size bytes of a region memory (READN) */
+int libreadn(struct pcb_t *proc, uint32_t source, uint32_t offset, uint32_t size)
+{
+  BYTE *buf = malloc(size > 0 ? size : 1);
+  if (buf == NULL) return -1;
+
+  int val = libread_range(proc, source, offset, buf, size);
+#ifdef IODUMP
+  printf("readn region=%d offset=%d size=%d\n", source, offset, size);
+  __range_dump(proc);
+#endif
+
+  free(buf);
+  return val;
+}
+
+/*libmemset - PAGING-based fill a byte range of a region memory (MEMSET) */
+int libmemset(struct pcb_t *proc, BYTE data, uint32_t destination,
+              uint32_t offset, uint32_t size)
+{
+  int val = __rw_range(proc, 0, destination, offset, &data, size, RANGE_FILL);
+#ifdef IODUMP
+  printf("memset region=%d offset=%d size=%d value=%d\n", destination, offset, size, data);
+  __range_dump(proc);
+#endif
+
+  return val;
 }
 
+/*libmemcpy - PAGING-based copy the first size bytes of a region to another (MEMCPY) */
+int libmemcpy(struct pcb_t *proc, uint32_t source, uint32_t destination, uint32_t size)
+{
+  // Đọc hết vào bộ đệm trước rồi mới ghi, nên hai vùng trùng nhau vẫn đúng
+  BYTE *buf = malloc(size > 0 ? size : 1);
+  if (buf == NULL) return -1;
 
-/*find_victim_page - find victim page
+  int val = libread_range(proc, source, 0, buf, size);
+  if (val == 0)
+    val = libwrite_range(proc, buf, destination, 0, size);
+#ifdef IODUMP
+  printf("memcpy region=%d -> region=%d size=%d\n", source, destination, size);
+  __range_dump(proc);
+#endif
+
+  free(buf);
+  return val;
+}
+
+/*free_pcb_memphy - collect all memphy of pcb
  *@caller: caller
- *@pgn: return page number
- *
+ *@vmaid: ID vm area to alloc memory region
+ *@incpgnum: number of page
  */
-// Tìm và trả về trang nạn nhân theo cơ chế FIFO
-int find_victim_page(struct mm_struct *mm, int *retpgn)
+int free_pcb_memph(struct pcb_t *caller)
 {
-  struct pgn_t *pg = mm->fifo_pgn;
+  int pagenum, fpn, swptyp, swpoff, nram = 0, nswp = 0;
+  uint32_t pte;
 
-  // Danh sách rỗng
-  if(pg == NULL) return -1;
+  pthread_mutex_lock(&caller->mm->lock);
 
-  // Chỉ có một trang
-  if(pg->pg_next == NULL){
-    *retpgn = pg->pgn;
-    free(pg);
-    mm->fifo_pgn = NULL;
-    return 0;
-  }
+  // Chỉ duyệt các trang có PTE, bỏ qua nguyên các bảng lá chưa được cấp
+  for(pagenum = pte_next(caller->mm, 0); pagenum != -1;
+      pagenum = pte_next(caller->mm, pagenum + 1))
+  {
+    pte= pte_get(caller->mm, pagenum);
 
-  // Duyệt để tìm trang cuối
-  struct pgn_t * prev_pg = NULL;
-  while(pg->pg_next != NULL){
-    prev_pg = pg;
-    pg = pg->pg_next;
+    if (!(pte & PAGING_PTE_SWAPPED_MASK))
+    {
+      // Trang đang ở RAM: gỡ khỏi danh sách thay trang, trả slot swap
+      // còn giữ làm bản sao (nếu có) rồi trả frame
+      fpn = PAGING_PTE_FPN(pte);
+      pgrep_del(caller->mm, fpn);
+      pgrep_swap_slot(fpn, 1, &swptyp, &swpoff); // Chỉ tra slot, không tính là lần thay trang sạch
+      if (swpoff != -1)
+      {
+        swp_put_slot(swptyp, swpoff);
+        pgrep_set_swap(fpn, 0, -1);
+        nswp++;
+      }
+      MEMPHY_put_freefp(caller->mram, fpn);
+      nram++;
+    } else {
+      fpn = PAGING_PTE_SWP(pte);
+      swp_put_slot(GETVAL(pte, PAGING_PTE_SWPTYP_MASK, PAGING_PTE_SWPTYP_LOBIT), fpn);
+      nswp++;
+    }
   }
-  
-  // Lưu số hiệu trang nạn nhân và xóa khỏi danh sách
-  *retpgn = pg->pgn;
-  prev_pg->pg_next = NULL;
-  free(pg);
+  tlb_flush(caller->mm);
+
+  // Không còn frame nào trỏ về mm này; chờ CPU đang quét global (nếu có)
+  // xong vòng quét trước khi mm bị giải phóng
+  pgrep_exit(nram, nswp);
+  pthread_mutex_unlock(&caller->mm->lock);
 
   return 0;
 }
 
+
 /*get_free_vmrg_area - get a free vm region
  *@caller: caller
  *@vmaid: ID vm area to alloc memory region
@@ -596,7 +902,8 @@ int get_free_vmrg_area(struct pcb_t *caller, int vmaid, int size, struct vm_rg_s
       new_free_rg->rg_start = rgit->rg_start + size;
       new_free_rg->rg_end = rgit->rg_end;
       new_free_rg->rg_next = NULL;
-      enlist_vm_freerg_list(caller->mm, new_free_rg);
+      if (enlist_vm_freerg_list(caller->mm, new_free_rg) == -1)
+        free(new_free_rg); // Vùng vừa khít, không còn dư byte nào thì bỏ nút rỗng
 
       free(rgit);
       return 0;
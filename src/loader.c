@@ -3,15 +3,41 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
 
 static uint32_t avail_pid = 1;
 
+/*
+ * Pre-compiled process image: a header followed by the packed
+ * struct inst_t array, exactly as run() reads it. load() maps the file
+ * and points code->text into the mapping, so nothing is parsed or
+ * copied. Images are produced from the text format by save_image().
+ */
+#define PROC_IMG_MAGIC		0x474d4950	/* "PIMG" */
+#define PROC_IMG_VERSION	1
+
+struct proc_img_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t inst_size;	/* sizeof(struct inst_t) of the writer */
+	uint32_t priority;
+	uint32_t size;		/* Number of instructions */
+	uint32_t reserved;
+};
+
 #define OPT_CALC	"calc"
 #define OPT_ALLOC	"alloc"
 #define OPT_FREE	"free"
 #define OPT_READ	"read"
 #define OPT_WRITE	"write"
 #define OPT_SYSCALL	"syscall"
+#define OPT_READN	"readn"
+#define OPT_MEMSET	"memset"
+#define OPT_MEMCPY	"memcpy"
 
 static enum ins_opcode_t get_opcode(char * opt) {
 	if (!strcmp(opt, OPT_CALC)) {
@@ -26,71 +52,145 @@ static enum ins_opcode_t get_opcode(char * opt) {
 		return WRITE;
 	}else if (!strcmp(opt, OPT_SYSCALL)) {
 		return SYSCALL;
+	}else if (!strcmp(opt, OPT_READN)) {
+		return READN;
+	}else if (!strcmp(opt, OPT_MEMSET)) {
+		return MEMSET;
+	}else if (!strcmp(opt, OPT_MEMCPY)) {
+		return MEMCPY;
 	}else{
 		printf("get_opcode return Opcode: %s\n", opt);
 		exit(1);
 	}
 }
 
-struct pcb_t * load(const char * path) {
-	/* Create new PCB for the new process */
-	struct pcb_t * proc = (struct pcb_t * )malloc(sizeof(struct pcb_t));
-	proc->pid = avail_pid;
-	avail_pid++;
-	proc->page_table =
-		(struct page_table_t*)malloc(sizeof(struct page_table_t));
-	proc->bp = PAGE_SIZE;
-	proc->pc = 0;
+/*
+ * Program cache: processes loaded from the same path share one
+ * immutable code segment. The cache entry embeds the code_seg_t as its
+ * first member, so release_code() gets back to the entry from the
+ * pointer stored in the PCB. The last release frees the text (or
+ * unmaps the image) and drops the entry.
+ */
+#define PROG_CACHE_SZ	64
 
-	/* Read process code from file */
-	FILE * file;
-	if ((file = fopen(path, "r")) == NULL) {
-		printf("Cannot find process description at '%s'\n", path);
-		exit(1);		
+struct prog_t {
+	struct code_seg_t code;		/* Must stay the first member */
+	char * path;
+	uint32_t priority;
+	int refcnt;
+	void * img_base;		/* Mapped image, NULL for parsed text */
+	size_t img_len;
+	struct prog_t * next;
+};
+
+static struct prog_t * prog_cache[PROG_CACHE_SZ];
+static pthread_mutex_t prog_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int prog_hash(const char * path) {
+	unsigned int h = 5381;
+	while (*path)
+		h = h * 33 + (unsigned char)*path++;
+	return h % PROG_CACHE_SZ;
+}
+
+/*
+ * load_image - map a pre-compiled process image into prog->code
+ * Return 0 on success, -1 if the file is not a valid image
+ */
+static int load_image(const char * path, struct prog_t * prog) {
+	struct proc_img_hdr * hdr;
+	struct stat st;
+	void * base;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return -1;
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct proc_img_hdr)) {
+		close(fd);
+		return -1;
 	}
-	snprintf(proc->path, 2*sizeof(path)+1, "%s", path);
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return -1;
+
+	hdr = (struct proc_img_hdr *)base;
+	if (hdr->magic != PROC_IMG_MAGIC || hdr->version != PROC_IMG_VERSION ||
+	    hdr->inst_size != sizeof(struct inst_t) ||
+	    (uint64_t)hdr->size * sizeof(struct inst_t) >
+	    (uint64_t)st.st_size - sizeof(struct proc_img_hdr)) {
+		printf("Invalid process image at '%s'\n", path);
+		munmap(base, st.st_size);
+		return -1;
+	}
+
+	prog->priority = hdr->priority;
+	prog->code.size = hdr->size;
+	prog->code.text = (struct inst_t *)(hdr + 1);
+	prog->img_base = base;
+	prog->img_len = st.st_size;
+	return 0;
+}
+
+/*
+ * load_text - parse a process description in the text format
+ */
+static void load_text(FILE * file, struct prog_t * prog) {
+	struct code_seg_t * code = &prog->code;
 	char opcode[10];
-	proc->code = (struct code_seg_t*)malloc(sizeof(struct code_seg_t));
-	fscanf(file, "%u %u", &proc->priority, &proc->code->size);
-	proc->code->text = (struct inst_t*)malloc(
-		sizeof(struct inst_t) * proc->code->size
+
+	fscanf(file, "%u %u", &prog->priority, &code->size);
+	code->text = (struct inst_t*)malloc(
+		sizeof(struct inst_t) * code->size
 	);
 	uint32_t i = 0;
 	char buf[200];
-	for (i = 0; i < proc->code->size; i++) {
+	for (i = 0; i < code->size; i++) {
 		fscanf(file, "%s", opcode);
-		proc->code->text[i].opcode = get_opcode(opcode);
-		switch(proc->code->text[i].opcode) {
+		code->text[i].opcode = get_opcode(opcode);
+		switch(code->text[i].opcode) {
 		case CALC:
 			break;
 		case ALLOC:
 			fscanf(
 				file,
 				"%u %u\n",
-				&proc->code->text[i].arg_0,
-				&proc->code->text[i].arg_1
+				&code->text[i].arg_0,
+				&code->text[i].arg_1
 			);
 			break;
 		case FREE:
-			fscanf(file, "%u\n", &proc->code->text[i].arg_0);
+			fscanf(file, "%u\n", &code->text[i].arg_0);
 			break;
 		case READ:
 		case WRITE:
+		case READN:
+		case MEMCPY:
 			fscanf(
 				file,
 				"%u %u %u\n",
-				&proc->code->text[i].arg_0,
-				&proc->code->text[i].arg_1,
-				&proc->code->text[i].arg_2
+				&code->text[i].arg_0,
+				&code->text[i].arg_1,
+				&code->text[i].arg_2
 			);
 			break;	
+		case MEMSET:
+			fscanf(
+				file,
+				"%u %u %u %u\n",
+				&code->text[i].arg_0,
+				&code->text[i].arg_1,
+				&code->text[i].arg_2,
+				&code->text[i].arg_3
+			);
+			break;
 		case SYSCALL:
 			fgets(buf, sizeof(buf), file);
 			sscanf(buf, "%d%d%d%d",
-			           &proc->code->text[i].arg_0,
-			           &proc->code->text[i].arg_1,
-			           &proc->code->text[i].arg_2,
-			           &proc->code->text[i].arg_3
+			           &code->text[i].arg_0,
+			           &code->text[i].arg_1,
+			           &code->text[i].arg_2,
+			           &code->text[i].arg_3
 			);
 			break;
 		default:
@@ -98,8 +198,155 @@ struct pcb_t * load(const char * path) {
 			exit(1);
 		}
 	}
-	return proc;
 }
 
+static void free_prog(struct prog_t * prog) {
+	if (prog->img_base != NULL)
+		munmap(prog->img_base, prog->img_len);
+	else
+		free(prog->code.text);
+	free(prog->path);
+	free(prog);
+}
+
+/* Must hold prog_lock */
+static struct prog_t * find_prog(const char * path, unsigned int h) {
+	struct prog_t * prog;
+	for (prog = prog_cache[h]; prog != NULL; prog = prog->next)
+		if (!strcmp(prog->path, path))
+			return prog;
+	return NULL;
+}
+
+/*
+ * get_prog - return the cached program at [path] with a new reference,
+ * reading it on a miss. The file is read outside the lock; if another
+ * thread cached the same path meanwhile, its copy wins.
+ */
+static struct prog_t * get_prog(const char * path) {
+	unsigned int h = prog_hash(path);
+	struct prog_t * prog, * other;
+	FILE * file;
 
+	pthread_mutex_lock(&prog_lock);
+	prog = find_prog(path, h);
+	if (prog != NULL) {
+		prog->refcnt++;
+		pthread_mutex_unlock(&prog_lock);
+		return prog;
+	}
+	pthread_mutex_unlock(&prog_lock);
 
+	/* Read process code from file */
+	if ((file = fopen(path, "r")) == NULL) {
+		printf("Cannot find process description at '%s'\n", path);
+		exit(1);		
+	}
+	prog = (struct prog_t *)calloc(1, sizeof(struct prog_t));
+	prog->path = strdup(path);
+	prog->refcnt = 1;
+
+	/* Pre-compiled image: map it instead of parsing */
+	uint32_t magic;
+	if (fread(&magic, sizeof(magic), 1, file) == 1 && magic == PROC_IMG_MAGIC) {
+		if (load_image(path, prog) < 0) {
+			exit(1);
+		}
+	}else{
+		rewind(file);
+		load_text(file, prog);
+	}
+	fclose(file);
+
+	pthread_mutex_lock(&prog_lock);
+	other = find_prog(path, h);
+	if (other != NULL) {
+		other->refcnt++;
+		pthread_mutex_unlock(&prog_lock);
+		free_prog(prog);
+		return other;
+	}
+	prog->next = prog_cache[h];
+	prog_cache[h] = prog;
+	pthread_mutex_unlock(&prog_lock);
+	return prog;
+}
+
+/*
+ * release_code - drop a PCB's reference to its code segment, the last
+ * one frees it
+ */
+void release_code(struct code_seg_t * code) {
+	struct prog_t * prog = (struct prog_t *)code;
+	struct prog_t ** pp;
+
+	if (code == NULL)
+		return;
+
+	pthread_mutex_lock(&prog_lock);
+	if (--prog->refcnt > 0) {
+		pthread_mutex_unlock(&prog_lock);
+		return;
+	}
+	for (pp = &prog_cache[prog_hash(prog->path)]; *pp != NULL; pp = &(*pp)->next) {
+		if (*pp == prog) {
+			*pp = prog->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&prog_lock);
+	free_prog(prog);
+}
+
+/*
+ * save_image - write [code] as a pre-compiled process image
+ */
+int save_image(const char * path, struct code_seg_t * code, uint32_t priority) {
+	struct proc_img_hdr hdr;
+	FILE * file;
+
+	if ((file = fopen(path, "wb")) == NULL)
+		return -1;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = PROC_IMG_MAGIC;
+	hdr.version = PROC_IMG_VERSION;
+	hdr.inst_size = sizeof(struct inst_t);
+	hdr.priority = priority;
+	hdr.size = code->size;
+
+	if (fwrite(&hdr, sizeof(hdr), 1, file) != 1 ||
+	    fwrite(code->text, sizeof(struct inst_t), code->size, file) != code->size) {
+		fclose(file);
+		return -1;
+	}
+	return fclose(file);
+}
+
+/*
+ * load_as - load the process at [path] under a caller-chosen pid, for
+ * loaders that prepare processes out of order
+ */
+struct pcb_t * load_as(const char * path, uint32_t pid) {
+	/* Create new PCB for the new process */
+	struct pcb_t * proc = (struct pcb_t * )malloc(sizeof(struct pcb_t));
+	proc->pid = pid;
+	proc->page_table =
+		(struct page_table_t*)malloc(sizeof(struct page_table_t));
+	proc->bp = PAGE_SIZE;
+	proc->pc = 0;
+	proc->q_prev = NULL;
+	proc->q_next = NULL;
+	proc->q_owner = NULL;
+
+	/* Processes of the same program share its code segment */
+	struct prog_t * prog = get_prog(path);
+	snprintf(proc->path, 2*sizeof(path)+1, "%s", path);
+	proc->priority = prog->priority;
+	proc->code = &prog->code;
+	return proc;
+}
+
+struct pcb_t * load(const char * path) {
+	return load_as(path, avail_pid++);
+}
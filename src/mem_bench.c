@@ -0,0 +1,174 @@
+/*
+ * READ/WRITE throughput micro-benchmark for the paging memory library
+ * Build with -DMM_PAGING and link against the memory and syscall modules:
+ *   mem_bench.c libmem.c mm.c mm-vm.c mm-memphy.c mm-repl.c mm-swap.c
+ *   syscall.c sys_*.c sched.c queue.c loader.c libstd.c
+ *
+ * Usage: mem_bench [region size] [number of passes]
+ *
+ * Allocates one region in a fresh process and sweeps it byte by byte
+ * with libwrite()/libread(), which reach the RAM frame directly, and with
+ * a copy of the former pg_setval()/pg_getval() that went through syscall
+ * 17 for every byte. Checks that both read back what was written and
+ * prints the average cost of one WRITE and one READ on each path.
+ */
+
+#include "mm.h"
+#include "syscall.h"
+#include "libmem.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#if !defined(MM_PAGING) || defined(IODUMP) || defined(DEBUG)
+#error "mem_bench requires MM_PAGING without IODUMP/DEBUG output"
+#endif
+
+#define BENCH_MEMSZ (1 << 20)
+
+/* The per-byte route pg_getval()/pg_setval() took before the fast path */
+static int sc_getval(struct mm_struct *mm, int addr, BYTE *data, struct pcb_t *caller) {
+	int fpn;
+	struct sc_regs regs;
+
+	if (pg_getpage(mm, PAGING_PGN(addr), &fpn, caller) == -1)
+		return -1;
+	regs.a1 = SYSMEM_IO_READ;
+	regs.a2 = fpn * PAGING_PAGESZ + PAGING_OFFST(addr);
+	if (syscall(caller, 17, &regs) == -1)
+		return -1;
+	*data = regs.a3;
+	return 0;
+}
+
+static int sc_setval(struct mm_struct *mm, int addr, BYTE value, struct pcb_t *caller) {
+	int fpn;
+	struct sc_regs regs;
+
+	if (pg_getpage(mm, PAGING_PGN(addr), &fpn, caller) == -1)
+		return -1;
+	regs.a1 = SYSMEM_IO_WRITE;
+	regs.a2 = fpn * PAGING_PAGESZ + PAGING_OFFST(addr);
+	regs.a3 = value;
+	return syscall(caller, 17, &regs);
+}
+
+static int sc_read(struct pcb_t * proc, int rgid, int offset, BYTE * data) {
+	struct vm_rg_struct * currg;
+	int ret = -1;
+
+	/* Same steps as __read()/__write() */
+	pthread_mutex_lock(&proc->mm->lock);
+	currg = get_symrg_byid(proc->mm, rgid);
+	if (currg != NULL && get_vma_by_num(proc->mm, 0) != NULL)
+		ret = sc_getval(proc->mm, currg->rg_start + offset, data, proc);
+	pthread_mutex_unlock(&proc->mm->lock);
+	return ret;
+}
+
+static int sc_write(struct pcb_t * proc, int rgid, int offset, BYTE value) {
+	struct vm_rg_struct * currg;
+	int ret = -1;
+
+	/* Same steps as __read()/__write() */
+	pthread_mutex_lock(&proc->mm->lock);
+	currg = get_symrg_byid(proc->mm, rgid);
+	if (currg != NULL && get_vma_by_num(proc->mm, 0) != NULL)
+		ret = sc_setval(proc->mm, currg->rg_start + offset, value, proc);
+	pthread_mutex_unlock(&proc->mm->lock);
+	return ret;
+}
+
+static double now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Sweep the region once writing, once reading, and verify the data */
+static int sweep(struct pcb_t * proc, int size, int passes, int direct,
+		double * wr_ns, double * rd_ns) {
+	int pass, off;
+	uint32_t val;
+	BYTE data;
+	double t0, t1, t2;
+
+	*wr_ns = 0;
+	*rd_ns = 0;
+	for (pass = 0; pass < passes; pass++) {
+		t0 = now_ns();
+		for (off = 0; off < size; off++) {
+			BYTE v = (BYTE)(off + pass);
+			if (direct)
+				libwrite(proc, v, 0, off);
+			else
+				sc_write(proc, 0, off, v);
+		}
+		t1 = now_ns();
+		for (off = 0; off < size; off++) {
+			if (direct) {
+				libread(proc, 0, off, &val);
+				data = (BYTE)val;
+			} else {
+				sc_read(proc, 0, off, &data);
+			}
+			if (data != (BYTE)(off + pass)) {
+				fprintf(stderr, "Mismatch at offset %d, pass %d\n", off, pass);
+				return -1;
+			}
+		}
+		t2 = now_ns();
+		*wr_ns += t1 - t0;
+		*rd_ns += t2 - t1;
+	}
+	*wr_ns /= (double)size * passes;
+	*rd_ns /= (double)size * passes;
+	return 0;
+}
+
+int main(int argc, char * argv[]) {
+	int size = (argc > 1) ? atoi(argv[1]) : 4096;
+	int passes = (argc > 2) ? atoi(argv[2]) : 200;
+	struct memphy_struct mram;
+	struct memphy_struct mswp[PAGING_MAX_MMSWP];
+	struct pcb_t proc;
+	double sc_wr, sc_rd, dir_wr, dir_rd;
+	int i;
+
+	if (size <= 0 || size > BENCH_MEMSZ / 2 || passes <= 0) {
+		fprintf(stderr, "Usage: %s [region size] [number of passes]\n", argv[0]);
+		return 1;
+	}
+
+	init_memphy(&mram, BENCH_MEMSZ, 1);
+	pgrep_init(&mram);
+	for (i = 0; i < PAGING_MAX_MMSWP; i++)
+		init_memphy(&mswp[i], BENCH_MEMSZ, 1);
+	swp_init(mswp);
+
+	memset(&proc, 0, sizeof(proc));
+	proc.pid = 1;
+	proc.mram = &mram;
+	proc.mswp = (struct memphy_struct **)&mswp;
+	proc.active_mswp = &mswp[0];
+	proc.mm = malloc(sizeof(struct mm_struct));
+	init_mm(proc.mm, &proc);
+
+	if (liballoc(&proc, size, 0) != 0) {
+		fprintf(stderr, "Cannot allocate a region of %d bytes\n", size);
+		return 1;
+	}
+
+	if (sweep(&proc, size, passes, 0, &sc_wr, &sc_rd) != 0 ||
+	    sweep(&proc, size, passes, 1, &dir_wr, &dir_rd) != 0)
+		return 1;
+
+	printf("%d bytes x %d passes\n", size, passes);
+	printf("syscall 17 : WRITE %7.1f ns  READ %7.1f ns\n", sc_wr, sc_rd);
+	printf("direct     : WRITE %7.1f ns  READ %7.1f ns\n", dir_wr, dir_rd);
+	printf("speedup    : WRITE %7.2fx   READ %7.2fx\n",
+		sc_wr / dir_wr, sc_rd / dir_rd);
+	return 0;
+}
@@ -9,6 +9,36 @@
 #include <stdlib.h>
 #include <string.h>
 
+/*
+ *  Locking: the storage array is accessed without locks, since a frame
+ *  belongs to one owner at a time and concurrent users touch different
+ *  cells. The head of a sequential device (cursor, seekdist) is guarded
+ *  by mp->csr_lock and the free-frame bitmap by mp->fp_lock; the two are
+ *  never held together.
+ */
+
+/*
+ *  __mv_csr - move MEMPHY cursor, caller holds mp->csr_lock
+ *
+ *  The head lands where stepping cell by cell from 0 would leave it, but
+ *  the trip is costed arithmetically: the forward or backward distance
+ *  from the current cursor is added to mp->seekdist.
+ */
+static int __mv_csr(struct memphy_struct *mp, int offset)
+{
+   int target;
+
+   if (mp->maxsz <= 0)
+      return -1;
+
+   target = (offset > 0 && offset < mp->maxsz) ? offset : 0;
+   mp->seekdist += (target >= mp->cursor) ? target - mp->cursor
+                                           : mp->cursor - target;
+   mp->cursor = target;
+
+   return 0;
+}
+
 /*
  *  MEMPHY_mv_csr - move MEMPHY cursor
  *  @mp: memphy struct
@@ -16,17 +46,50 @@
  */
 int MEMPHY_mv_csr(struct memphy_struct *mp, int offset)
 {
-   int numstep = 0;
+   int ret;
 
-   mp->cursor = 0;
-   while (numstep < offset && numstep < mp->maxsz)
-   {
-      /* Traverse sequentially */
-      mp->cursor = (mp->cursor + 1) % mp->maxsz;
-      numstep++;
-   }
+   if (mp == NULL)
+      return -1;
 
-   return 0;
+   pthread_mutex_lock(&mp->csr_lock);
+   ret = __mv_csr(mp, offset);
+   pthread_mutex_unlock(&mp->csr_lock);
+
+   return ret;
+}
+
+/*
+ *  __seq_pass - seek to addr and let len cells stream past the head
+ */
+static int __seq_pass(struct memphy_struct *mp, int addr, int len)
+{
+   int ret;
+
+   pthread_mutex_lock(&mp->csr_lock);
+   ret = __mv_csr(mp, addr);
+   if (ret == 0)
+      mp->cursor = (mp->cursor + len) % mp->maxsz;
+   pthread_mutex_unlock(&mp->csr_lock);
+
+   return ret;
+}
+
+/*
+ *  MEMPHY_get_seekdist - total cursor travel of a sequential device
+ *  @mp: memphy struct
+ */
+unsigned long MEMPHY_get_seekdist(struct memphy_struct *mp)
+{
+   unsigned long dist;
+
+   if (mp == NULL)
+      return 0;
+
+   pthread_mutex_lock(&mp->csr_lock);
+   dist = mp->seekdist;
+   pthread_mutex_unlock(&mp->csr_lock);
+
+   return dist;
 }
 
 /*
@@ -40,10 +103,11 @@ int MEMPHY_seq_read(struct memphy_struct *mp, int addr, BYTE *value)
    if (mp == NULL)
       return -1;
 
-   if (!mp->rdmflg)
+   if (mp->rdmflg)
       return -1; /* Not compatible mode for sequential read */
 
-   MEMPHY_mv_csr(mp, addr);
+   if (__seq_pass(mp, addr, 1) != 0)
+      return -1;
    *value = (BYTE)mp->storage[addr];
 
    return 0;
@@ -57,7 +121,7 @@ int MEMPHY_seq_read(struct memphy_struct *mp, int addr, BYTE *value)
  */
 int MEMPHY_read(struct memphy_struct *mp, int addr, BYTE *value)
 {
-   if (mp == NULL)
+   if (mp == NULL || addr < 0 || addr >= mp->maxsz)
       return -1;
 
    if (mp->rdmflg)
@@ -80,10 +144,11 @@ int MEMPHY_seq_write(struct memphy_struct *mp, int addr, BYTE value)
    if (mp == NULL)
       return -1;
 
-   if (!mp->rdmflg)
-      return -1; /* Not compatible mode for sequential read */
+   if (mp->rdmflg)
+      return -1; /* Not compatible mode for sequential write */
 
-   MEMPHY_mv_csr(mp, addr);
+   if (__seq_pass(mp, addr, 1) != 0)
+      return -1;
    mp->storage[addr] = value;
 
    return 0;
@@ -97,7 +162,7 @@ int MEMPHY_seq_write(struct memphy_struct *mp, int addr, BYTE value)
  */
 int MEMPHY_write(struct memphy_struct *mp, int addr, BYTE data)
 {
-   if (mp == NULL)
+   if (mp == NULL || addr < 0 || addr >= mp->maxsz)
       return -1;
 
    if (mp->rdmflg)
@@ -108,6 +173,86 @@ int MEMPHY_write(struct memphy_struct *mp, int addr, BYTE data)
    return 0;
 }
 
+/*
+ *  MEMPHY_read_range - read len contiguous bytes of MEMPHY device
+ *  @mp: memphy struct
+ *  @addr: address of the first byte
+ *  @buf: buffer of len bytes
+ *  @len: number of bytes
+ */
+int MEMPHY_read_range(struct memphy_struct *mp, int addr, BYTE *buf, int len)
+{
+   if (mp == NULL || buf == NULL || addr < 0 || len < 0 || addr + len > mp->maxsz)
+      return -1;
+
+   /* One seek to addr, then the range streams past the head */
+   if (!mp->rdmflg)
+      __seq_pass(mp, addr, len);
+   memcpy(buf, mp->storage + addr, len);
+
+   return 0;
+}
+
+/*
+ *  MEMPHY_write_range - write len contiguous bytes of MEMPHY device
+ *  @mp: memphy struct
+ *  @addr: address of the first byte
+ *  @buf: buffer of len bytes
+ *  @len: number of bytes
+ */
+int MEMPHY_write_range(struct memphy_struct *mp, int addr, const BYTE *buf, int len)
+{
+   if (mp == NULL || buf == NULL || addr < 0 || len < 0 || addr + len > mp->maxsz)
+      return -1;
+
+   if (!mp->rdmflg)
+      __seq_pass(mp, addr, len);
+   memcpy(mp->storage + addr, buf, len);
+
+   return 0;
+}
+
+/*
+ *  MEMPHY_read_page - read a whole frame of MEMPHY device
+ *  @mp: memphy struct
+ *  @fpn: frame page number
+ *  @buf: buffer of PAGING_PAGESZ bytes
+ */
+int MEMPHY_read_page(struct memphy_struct *mp, int fpn, BYTE *buf)
+{
+   if (fpn < 0)
+      return -1;
+
+   return MEMPHY_read_range(mp, fpn * PAGING_PAGESZ, buf, PAGING_PAGESZ);
+}
+
+/*
+ *  MEMPHY_write_page - write a whole frame of MEMPHY device
+ *  @mp: memphy struct
+ *  @fpn: frame page number
+ *  @buf: buffer of PAGING_PAGESZ bytes
+ */
+int MEMPHY_write_page(struct memphy_struct *mp, int fpn, const BYTE *buf)
+{
+   if (fpn < 0)
+      return -1;
+
+   return MEMPHY_write_range(mp, fpn * PAGING_PAGESZ, buf, PAGING_PAGESZ);
+}
+
+/*
+ *  Free frames are tracked in mp->fp_bitmap, one bit per frame, set while
+ *  the frame is in use. mp->fp_hint is the first bitmap word that may
+ *  still hold a free frame, so a lookup skips the full words in front of
+ *  it; get/put are O(1) apart from that word-at-a-time scan.
+ *
+ *  Frames are handed out one at a time only. RAM is filled on first
+ *  touch, one page per fault, through alloc_ram_frame() and its watermark
+ *  check, and each swap-out needs a single slot, so nothing ever asks
+ *  for a contiguous run of frames.
+ */
+#define FP_BM_BITS 64
+
 /*
  *  MEMPHY_format-format MEMPHY device
  *  @mp: memphy struct
@@ -116,46 +261,96 @@ int MEMPHY_format(struct memphy_struct *mp, int pagesz)
 {
    /* This setting come with fixed constant PAGESZ */
    int numfp = mp->maxsz / pagesz;
-   struct framephy_struct *newfst, *fst;
-   int iter = 0;
+
+   mp->free_fp_list = NULL;
+   mp->fp_bitmap = NULL;
+   mp->fp_total = 0;
+   mp->fp_free = 0;
+   mp->fp_hint = 0;
 
    if (numfp <= 0)
       return -1;
 
-   /* Init head of free framephy list */
-   fst = malloc(sizeof(struct framephy_struct));
-   fst->fpn = iter;
-   mp->free_fp_list = fst;
+   /* An all-zero bitmap is an all-free device; calloc gets it zeroed
+    * without touching it, so formatting costs the same for any size */
+   mp->fp_bitmap = calloc(DIV_ROUND_UP(numfp, FP_BM_BITS), sizeof(uint64_t));
+   if (mp->fp_bitmap == NULL)
+      return -1;
+
+   mp->fp_total = numfp;
+   mp->fp_free = numfp;
+
+   return 0;
+}
+
+/*
+ *  __get_freefp - take the lowest free frame,
+ *  caller holds mp->fp_lock
+ *  @mp: memphy struct
+ *  @retfpn: obtained frame page number
+ */
+static int __get_freefp(struct memphy_struct *mp, int *retfpn)
+{
+   int nwords, w, fpn;
+   uint64_t avail;
+
+   if (mp->fp_free == 0)
+      return -1;
 
-   /* We have list with first element, fill in the rest num-1 element member*/
-   for (iter = 1; iter < numfp; iter++)
+   nwords = DIV_ROUND_UP(mp->fp_total, FP_BM_BITS);
+   for (w = mp->fp_hint; w < nwords; w++)
    {
-      newfst = malloc(sizeof(struct framephy_struct));
-      newfst->fpn = iter;
-      newfst->fp_next = NULL;
-      fst->fp_next = newfst;
-      fst = newfst;
+      avail = ~mp->fp_bitmap[w];
+      if (avail == 0)
+         continue;
+
+      fpn = w * FP_BM_BITS + __builtin_ctzll(avail);
+      if (fpn >= mp->fp_total)
+         break;
+
+      mp->fp_bitmap[w] |= 1ULL << (fpn % FP_BM_BITS);
+      mp->fp_free--;
+      mp->fp_hint = w;
+      *retfpn = fpn;
+      return 0;
    }
 
-   return 0;
+   return -1;
 }
 
+/*
+ *  MEMPHY_get_freefp - __get_freefp under the device frame lock
+ */
 int MEMPHY_get_freefp(struct memphy_struct *mp, int *retfpn)
 {
-   struct framephy_struct *fp = mp->free_fp_list;
+   int ret;
 
-   if (fp == NULL)
+   if (mp == NULL)
       return -1;
 
-   *retfpn = fp->fpn;
-   mp->free_fp_list = fp->fp_next;
+   pthread_mutex_lock(&mp->fp_lock);
+   ret = __get_freefp(mp, retfpn);
+   pthread_mutex_unlock(&mp->fp_lock);
 
-   /* MEMPHY is iteratively used up until its exhausted
-    * No garbage collector acting then it not been released
-    */
-   free(fp);
+   return ret;
+}
 
-   return 0;
+/*
+ *  MEMPHY_get_nfree - number of free frames on the device
+ *  @mp: memphy struct
+ */
+int MEMPHY_get_nfree(struct memphy_struct *mp)
+{
+   int nfree;
+
+   if (mp == NULL)
+      return 0;
+
+   pthread_mutex_lock(&mp->fp_lock);
+   nfree = mp->fp_free;
+   pthread_mutex_unlock(&mp->fp_lock);
+
+   return nfree;
 }
 
 int MEMPHY_dump(struct memphy_struct *mp)
@@ -208,34 +403,65 @@ int MEMPHY_dump(struct memphy_struct *mp)
    return 0;
 }
 
-int MEMPHY_put_freefp(struct memphy_struct *mp, int fpn)
+/*
+ *  __put_freefp - give a frame back to the device,
+ *  caller holds mp->fp_lock
+ *  @mp: memphy struct
+ *  @fpn: frame page number
+ */
+static int __put_freefp(struct memphy_struct *mp, int fpn)
 {
-   struct framephy_struct *fp = mp->free_fp_list;
-   struct framephy_struct *newnode = malloc(sizeof(struct framephy_struct));
+   uint64_t bit;
+
+   if (fpn < 0 || fpn >= mp->fp_total)
+      return -1;
+
+   bit = 1ULL << (fpn % FP_BM_BITS);
+   if (!(mp->fp_bitmap[fpn / FP_BM_BITS] & bit))
+      return -1; /* Frame is already free */
 
-   /* Create new node with value fpn */
-   newnode->fpn = fpn;
-   newnode->fp_next = fp;
-   mp->free_fp_list = newnode;
+   mp->fp_bitmap[fpn / FP_BM_BITS] &= ~bit;
+   mp->fp_free++;
+   if (fpn / FP_BM_BITS < mp->fp_hint)
+      mp->fp_hint = fpn / FP_BM_BITS;
 
    return 0;
 }
 
+/*
+ *  MEMPHY_put_freefp - __put_freefp under the device frame lock
+ */
+int MEMPHY_put_freefp(struct memphy_struct *mp, int fpn)
+{
+   int ret;
+
+   if (mp == NULL)
+      return -1;
+
+   pthread_mutex_lock(&mp->fp_lock);
+   ret = __put_freefp(mp, fpn);
+   pthread_mutex_unlock(&mp->fp_lock);
+
+   return ret;
+}
+
 /*
  *  Init MEMPHY struct
  */
 int init_memphy(struct memphy_struct *mp, int max_size, int randomflg)
 {
-   mp->storage = (BYTE *)malloc(max_size * sizeof(BYTE));
+   mp->storage = (BYTE *)calloc(max_size, sizeof(BYTE));
    mp->maxsz = max_size;
-   memset(mp->storage, 0, max_size * sizeof(BYTE));
 
+   pthread_mutex_init(&mp->fp_lock, NULL);
+   pthread_mutex_init(&mp->csr_lock, NULL);
    MEMPHY_format(mp, PAGING_PAGESZ);
 
    mp->rdmflg = (randomflg != 0) ? 1 : 0;
 
-   if (!mp->rdmflg) /* Not Ramdom acess device, then it serial device*/
-      mp->cursor = 0;
+   /* Not Ramdom acess device, then it serial device*/
+   mp->cursor = 0;
+   mp->seekdist = 0;
 
    return 0;
 }
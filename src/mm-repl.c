@@ -0,0 +1,462 @@
+// #ifdef MM_PAGING
+/*
+ * PAGING based Memory Management
+ * Page replacement module mm/mm-repl.c
+ */
+
+#include "mm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/*
+ * Every RAM frame owns one node of a pool allocated once at startup, so
+ * tracking a resident page never allocates. A node records which page of
+ * which mm lives in the frame and links the frame into the FIFO of its
+ * owner: mm->fifo_head is the oldest resident page, mm->fifo_tail the
+ * newest, and links are frame numbers (-1 ends the list). Each resident
+ * page is in the list exactly once, enlisting, unlinking and picking a
+ * victim are O(1), and memory use is bounded by the size of RAM.
+ *
+ * A node is only touched under the mm->lock of its owner.
+ */
+struct pgrep_node {
+  struct mm_struct *mm; /* Owner of the page in this frame, NULL if none */
+  int pgn;              /* Page number of that page in its owner */
+  int prev;             /* Frame holding the next older page */
+  int next;             /* Frame holding the next newer page */
+  unsigned char age;    /* Reference history for the aging policy */
+  int swptyp;           /* Swap device of the copy backing this frame */
+  int swpoff;           /* Swap frame of that copy, -1 if none */
+};
+
+static struct pgrep_node *pgrep_pool;
+static int pgrep_nframes;
+
+/*
+ * Replacement policies. select() is called with mm->lock held and picks
+ * a resident page to evict, unlinks it and returns its owner in *vicmm.
+ * A victim from another mm comes back with that mm's lock held too; the
+ * caller drops it once the page is swapped out.
+ */
+struct pgrep_policy {
+  const char *name;
+  int (*select)(struct mm_struct *mm, struct mm_struct **vicmm,
+                int *retpgn, int *retfpn);
+};
+
+static const struct pgrep_policy *pgrep_cur;
+static unsigned long pgrep_nmajflt;
+static unsigned long pgrep_nminflt;
+static unsigned long pgrep_nevict;
+static unsigned long pgrep_nclean;
+
+/*
+ * Direct reclaim: once the free RAM frames drop to the low watermark,
+ * the faulting CPU evicts pages until the high watermark is reached.
+ * With both at 0 it evicts one page when RAM is full.
+ */
+static int pgrep_wmark_low;
+static int pgrep_wmark_high;
+static unsigned long pgrep_nstall;
+static unsigned long pgrep_nreclaim;
+
+/* Frames and swap slots returned by finished processes */
+static unsigned long pgrep_nexit;
+static unsigned long pgrep_nexit_ram;
+static unsigned long pgrep_nexit_swp;
+
+/* Clock hand of the global policy, shared by all CPUs */
+static int pgrep_hand;
+static pthread_mutex_t pgrep_hand_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Resident pages always have a PTE, so the lookups below never fail */
+#define PTE_REFERENCED(mm, pgn) (*pte_lookup(mm, pgn) & PAGING_PTE_REFER_MASK)
+#define PTE_CLR_REFERENCED(mm, pgn) CLRBIT(*pte_lookup(mm, pgn), PAGING_PTE_REFER_MASK)
+
+/*
+ * pgrep_add - a page of mm became resident in frame fpn
+ * @mm  : owner of the page
+ * @pgn : page number (PGN)
+ * @fpn : frame page number (FPN)
+ */
+int pgrep_add(struct mm_struct *mm, int pgn, int fpn)
+{
+  struct pgrep_node *node;
+
+  if (fpn < 0 || fpn >= pgrep_nframes)
+    return -1;
+
+  node = &pgrep_pool[fpn];
+  if (node->mm != NULL)
+    pgrep_del(node->mm, fpn);
+
+  node->mm = mm;
+  node->pgn = pgn;
+  node->age = 0;
+  node->prev = mm->fifo_tail;
+  node->next = -1;
+  PTE_CLR_REFERENCED(mm, pgn);
+
+  if (mm->fifo_tail != -1)
+    pgrep_pool[mm->fifo_tail].next = fpn;
+  else
+    mm->fifo_head = fpn;
+  mm->fifo_tail = fpn;
+
+  return 0;
+}
+
+/*
+ * pgrep_del - the page of mm in frame fpn left RAM
+ * @mm  : owner of the page
+ * @fpn : frame page number (FPN)
+ */
+int pgrep_del(struct mm_struct *mm, int fpn)
+{
+  struct pgrep_node *node;
+
+  if (fpn < 0 || fpn >= pgrep_nframes || pgrep_pool[fpn].mm != mm)
+    return -1;
+
+  node = &pgrep_pool[fpn];
+  if (node->prev != -1)
+    pgrep_pool[node->prev].next = node->next;
+  else
+    mm->fifo_head = node->next;
+
+  if (node->next != -1)
+    pgrep_pool[node->next].prev = node->prev;
+  else
+    mm->fifo_tail = node->prev;
+
+  node->mm = NULL;
+  node->prev = -1;
+  node->next = -1;
+
+  return 0;
+}
+
+/* Unlink the page in frame fpn and hand it out as the victim */
+static int pgrep_take(struct mm_struct *vicmm, int fpn, struct mm_struct **retmm,
+                      int *retpgn, int *retfpn)
+{
+  *retmm = vicmm;
+  *retpgn = pgrep_pool[fpn].pgn;
+  *retfpn = fpn;
+  pgrep_del(vicmm, fpn);
+
+  return 0;
+}
+
+/* FIFO: the page of mm resident for the longest time */
+static int fifo_select(struct mm_struct *mm, struct mm_struct **vicmm,
+                       int *retpgn, int *retfpn)
+{
+  if (mm->fifo_head == -1)
+    return -1;
+
+  return pgrep_take(mm, mm->fifo_head, vicmm, retpgn, retfpn);
+}
+
+/*
+ * CLOCK (second chance) over the FIFO of mm: a referenced page at the
+ * head loses its bit and goes to the tail, the first unreferenced one
+ * is the victim. At most one lap clears every bit.
+ */
+static int clock_select(struct mm_struct *mm, struct mm_struct **vicmm,
+                        int *retpgn, int *retfpn)
+{
+  int fpn, pgn;
+
+  while ((fpn = mm->fifo_head) != -1)
+  {
+    pgn = pgrep_pool[fpn].pgn;
+    if (!PTE_REFERENCED(mm, pgn))
+      return pgrep_take(mm, fpn, vicmm, retpgn, retfpn);
+
+    pgrep_del(mm, fpn);
+    pgrep_add(mm, pgn, fpn); /* Clears the referenced bit */
+  }
+
+  return -1;
+}
+
+/*
+ * Aging LRU approximation: each time a victim is chosen, every resident
+ * page of mm shifts its referenced bit into an 8-bit age, and the page
+ * with the lowest age (the oldest one on ties) is the victim. Ages only
+ * move at eviction time, so a choice costs one pass over the resident
+ * pages of mm; faults served without an eviction cost nothing extra.
+ */
+static int lru_select(struct mm_struct *mm, struct mm_struct **vicmm,
+                      int *retpgn, int *retfpn)
+{
+  struct pgrep_node *node;
+  int fpn, pgn, vic = -1;
+
+  for (fpn = mm->fifo_head; fpn != -1; fpn = node->next)
+  {
+    node = &pgrep_pool[fpn];
+    pgn = node->pgn;
+    node->age = (node->age >> 1) | (PTE_REFERENCED(mm, pgn) ? 0x80 : 0);
+    PTE_CLR_REFERENCED(mm, pgn);
+
+    if (vic == -1 || node->age < pgrep_pool[vic].age)
+      vic = fpn;
+  }
+
+  if (vic == -1)
+    return -1;
+
+  return pgrep_take(mm, vic, vicmm, retpgn, retfpn);
+}
+
+/*
+ * Global CLOCK over every RAM frame, whatever process owns it. Another
+ * owner is only inspected if its lock can be taken without waiting, so
+ * two faulting CPUs never wait on each other's mm.
+ */
+static int global_select(struct mm_struct *mm, struct mm_struct **vicmm,
+                         int *retpgn, int *retfpn)
+{
+  struct mm_struct *owner;
+  int step, fpn, ret = -1;
+
+  pthread_mutex_lock(&pgrep_hand_lock);
+  for (step = 0; step < 2 * pgrep_nframes && ret == -1; step++)
+  {
+    fpn = pgrep_hand;
+    pgrep_hand = (pgrep_hand + 1) % pgrep_nframes;
+
+    owner = pgrep_pool[fpn].mm;
+    if (owner == NULL)
+      continue;
+    if (owner != mm && pthread_mutex_trylock(&owner->lock) != 0)
+      continue;
+
+    /* The frame may have changed hands before the lock was taken */
+    if (pgrep_pool[fpn].mm == owner)
+    {
+      if (!PTE_REFERENCED(owner, pgrep_pool[fpn].pgn))
+      {
+        ret = pgrep_take(owner, fpn, vicmm, retpgn, retfpn);
+        continue; /* Keep the owner locked for the caller */
+      }
+      PTE_CLR_REFERENCED(owner, pgrep_pool[fpn].pgn);
+    }
+
+    if (owner != mm)
+      pthread_mutex_unlock(&owner->lock);
+  }
+  pthread_mutex_unlock(&pgrep_hand_lock);
+
+  return ret;
+}
+
+static const struct pgrep_policy pgrep_policies[] = {
+  { "fifo",   fifo_select },
+  { "clock",  clock_select },
+  { "lru",    lru_select },
+  { "global", global_select },
+};
+
+/*
+ * pgrep_init - allocate the node pool for the RAM device
+ * @mram : RAM memphy struct
+ */
+int pgrep_init(struct memphy_struct *mram)
+{
+  int fpn;
+
+  pgrep_cur = &pgrep_policies[0];
+  pgrep_nframes = mram->maxsz / PAGING_PAGESZ;
+  pgrep_pool = malloc(pgrep_nframes * sizeof(struct pgrep_node));
+  if (pgrep_pool == NULL)
+    return -1;
+
+  for (fpn = 0; fpn < pgrep_nframes; fpn++)
+  {
+    pgrep_pool[fpn].mm = NULL;
+    pgrep_pool[fpn].prev = -1;
+    pgrep_pool[fpn].next = -1;
+    pgrep_pool[fpn].swpoff = -1;
+  }
+
+  return 0;
+}
+
+/*
+ * pgrep_set_policy - select the replacement policy by name
+ * @name : "fifo", "clock", "lru" or "global"
+ */
+int pgrep_set_policy(const char *name)
+{
+  size_t i;
+
+  for (i = 0; i < sizeof(pgrep_policies) / sizeof(pgrep_policies[0]); i++)
+  {
+    if (!strcmp(name, pgrep_policies[i].name))
+    {
+      pgrep_cur = &pgrep_policies[i];
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+/*
+ * pgrep_select - pick and unlink the page to evict for a fault in mm
+ * @mm     : faulting memory management struct, locked by the caller
+ * @vicmm  : return owner of the victim, locked if it is not mm
+ * @retpgn : return page number (PGN) of the victim
+ * @retfpn : return frame page number (FPN) it occupies
+ */
+int pgrep_select(struct mm_struct *mm, struct mm_struct **vicmm,
+                 int *retpgn, int *retfpn)
+{
+  /* A process without resident pages of its own takes one from another */
+  if (pgrep_cur->select(mm, vicmm, retpgn, retfpn) != 0 &&
+      (pgrep_cur->select == global_select ||
+       global_select(mm, vicmm, retpgn, retfpn) != 0))
+    return -1;
+
+  __atomic_add_fetch(&pgrep_nevict, 1, __ATOMIC_RELAXED);
+  return 0;
+}
+
+/*
+ * A page read in from swap keeps its swap frame: as long as the page is
+ * not written, that copy stays valid and evicting it again only has to
+ * point the PTE back at it. The association lives with the RAM frame and
+ * is dropped once the page leaves the frame.
+ */
+
+/*
+ * pgrep_set_swap - record the swap copy backing the page in frame fpn
+ * @fpn    : frame page number (FPN)
+ * @swptyp : swap device of the copy
+ * @swpoff : swap frame of the copy, -1 to drop the association
+ */
+int pgrep_set_swap(int fpn, int swptyp, int swpoff)
+{
+  if (fpn < 0 || fpn >= pgrep_nframes)
+    return -1;
+
+  pgrep_pool[fpn].swptyp = swptyp;
+  pgrep_pool[fpn].swpoff = swpoff;
+  return 0;
+}
+
+/*
+ * pgrep_swap_slot - find where to evict the page in frame fpn
+ * @fpn    : frame page number (FPN) of the victim
+ * @dirty  : the page was written since it came into RAM
+ * @swptyp : return swap device of the copy, if any
+ * @swpoff : return swap frame of the copy, -1 if none
+ *
+ * Return 1 if the page has to be written out, 0 if the copy is current.
+ */
+int pgrep_swap_slot(int fpn, int dirty, int *swptyp, int *swpoff)
+{
+  *swpoff = -1;
+  if (fpn < 0 || fpn >= pgrep_nframes)
+    return 1;
+
+  *swptyp = pgrep_pool[fpn].swptyp;
+  *swpoff = pgrep_pool[fpn].swpoff;
+  if (dirty || *swpoff == -1)
+    return 1;
+
+  __atomic_add_fetch(&pgrep_nclean, 1, __ATOMIC_RELAXED);
+  return 0;
+}
+
+/*
+ * pgrep_set_wmark - set the free frame watermarks of direct reclaim
+ * @low  : reclaim when free frames drop to this many
+ * @high : number of free frames to reclaim up to
+ */
+int pgrep_set_wmark(int low, int high)
+{
+  if (low < 0 || high < low || high > pgrep_nframes)
+    return -1;
+
+  pgrep_wmark_low = low;
+  pgrep_wmark_high = high;
+  return 0;
+}
+
+/*
+ * pgrep_get_wmark - get the free frame watermarks of direct reclaim
+ * @low  : return low watermark
+ * @high : return high watermark
+ */
+int pgrep_get_wmark(int *low, int *high)
+{
+  *low = pgrep_wmark_low;
+  *high = pgrep_wmark_high;
+  return 0;
+}
+
+/*
+ * pgrep_stall - count a direct reclaim stall
+ * @npages : number of pages it evicted
+ */
+int pgrep_stall(int npages)
+{
+  __atomic_add_fetch(&pgrep_nstall, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&pgrep_nreclaim, npages, __ATOMIC_RELAXED);
+  return 0;
+}
+
+/*
+ * pgrep_exit - a process gave back all its frames
+ * @nram : number of RAM frames it released
+ * @nswp : number of swap slots it released
+ *
+ * None of its frames is in the pool any more, but a global scan that
+ * read the owner before that may still be about to trylock it. Such a
+ * scan holds the clock hand lock, so taking that lock once waits it out
+ * and the mm can then be freed.
+ */
+int pgrep_exit(int nram, int nswp)
+{
+  pthread_mutex_lock(&pgrep_hand_lock);
+  pgrep_nexit++;
+  pgrep_nexit_ram += nram;
+  pgrep_nexit_swp += nswp;
+  pthread_mutex_unlock(&pgrep_hand_lock);
+
+  return 0;
+}
+
+/*
+ * pgrep_fault - count a page fault
+ * @minor : first touch served with a zeroed frame, not read from swap
+ */
+int pgrep_fault(int minor)
+{
+  __atomic_add_fetch(minor ? &pgrep_nminflt : &pgrep_nmajflt, 1, __ATOMIC_RELAXED);
+  return 0;
+}
+
+/*
+ * pgrep_report - print the fault and eviction counters of the policy
+ */
+int pgrep_report(void)
+{
+  printf("Page replacement (%s): %lu major faults, %lu minor faults,"
+         " %lu evictions (%lu clean, write-back skipped)\n",
+         pgrep_cur->name, pgrep_nmajflt, pgrep_nminflt, pgrep_nevict,
+         pgrep_nclean);
+  printf("Direct reclaim (low %d, high %d): %lu stalls, %lu pages reclaimed\n",
+         pgrep_wmark_low, pgrep_wmark_high, pgrep_nstall, pgrep_nreclaim);
+  printf("Teardown: %lu processes, %lu RAM frames and %lu swap slots reclaimed\n",
+         pgrep_nexit, pgrep_nexit_ram, pgrep_nexit_swp);
+  return 0;
+}
+
+// #endif
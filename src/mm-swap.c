@@ -0,0 +1,112 @@
+// #ifdef MM_PAGING
+/*
+ * PAGING based Memory Management
+ * Swap manager mm/mm-swap.c
+ */
+
+#include "mm.h"
+#include <stdio.h>
+
+/*
+ * Swap slots are handed out over every configured swap device instead of
+ * one device per process. Devices of size 0 are left out. A slot is named
+ * by its device id, the index in the mswp[] array that goes in the swap
+ * type field of the PTE, and the swap frame on that device.
+ *
+ * Successive allocations start on the next device in turn, so consecutive
+ * evictions are striped across the devices; a full device is skipped.
+ */
+static struct memphy_struct *swp_dev[PAGING_MAX_MMSWP];
+static int swp_ids[PAGING_MAX_MMSWP]; /* Ids of the usable devices */
+static int swp_ndev;
+static unsigned int swp_next;
+static unsigned long swp_nout[PAGING_MAX_MMSWP];
+
+/*
+ * swp_init - register the swap devices
+ * @mswp : array of PAGING_MAX_MMSWP swap devices
+ */
+int swp_init(struct memphy_struct *mswp)
+{
+  int id;
+
+  swp_ndev = 0;
+  for (id = 0; id < PAGING_MAX_MMSWP; id++)
+  {
+    swp_dev[id] = &mswp[id];
+    if (mswp[id].maxsz >= PAGING_PAGESZ)
+      swp_ids[swp_ndev++] = id;
+  }
+
+  return (swp_ndev > 0) ? 0 : -1;
+}
+
+/*
+ * swp_get_dev - swap device of a swap type
+ * @swptyp : device id
+ */
+struct memphy_struct *swp_get_dev(int swptyp)
+{
+  if (swptyp < 0 || swptyp >= PAGING_MAX_MMSWP)
+    return NULL;
+
+  return swp_dev[swptyp];
+}
+
+/*
+ * swp_get_slot - allocate a free swap frame on one of the devices
+ * @swptyp : return device id
+ * @swpoff : return swap frame on that device
+ */
+int swp_get_slot(int *swptyp, int *swpoff)
+{
+  unsigned int start;
+  int i, id;
+
+  if (swp_ndev == 0)
+    return -1;
+
+  start = __atomic_fetch_add(&swp_next, 1, __ATOMIC_RELAXED);
+  for (i = 0; i < swp_ndev; i++)
+  {
+    id = swp_ids[(start + i) % swp_ndev];
+    if (MEMPHY_get_freefp(swp_dev[id], swpoff) == 0)
+    {
+      *swptyp = id;
+      __atomic_add_fetch(&swp_nout[id], 1, __ATOMIC_RELAXED);
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+/*
+ * swp_put_slot - release a swap frame
+ * @swptyp : device id
+ * @swpoff : swap frame on that device
+ */
+int swp_put_slot(int swptyp, int swpoff)
+{
+  struct memphy_struct *mp = swp_get_dev(swptyp);
+
+  if (mp == NULL)
+    return -1;
+
+  return MEMPHY_put_freefp(mp, swpoff);
+}
+
+/*
+ * swp_report - print how many slots each device handed out
+ */
+int swp_report(void)
+{
+  int i;
+
+  for (i = 0; i < swp_ndev; i++)
+    printf("MEMSWP %d: %lu slots allocated\n", swp_ids[i], swp_nout[swp_ids[i]]);
+
+  return 0;
+}
+
+// #endif
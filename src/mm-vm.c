@@ -36,10 +36,13 @@ struct vm_area_struct *get_vma_by_num(struct mm_struct *mm, int vmaid)
   return pvma;
 }
 
-int __mm_swap_page(struct pcb_t *caller, int vicfpn , int swpfpn)
+int __mm_swap_page(struct pcb_t *caller, int vicfpn , int swptyp, int swpfpn)
 {
-    __swap_cp_page(caller->mram, vicfpn, caller->active_mswp, swpfpn);
-    return 0;
+    // Ghi trang ra đúng thiết bị swap mà bộ quản lý swap đã cấp slot
+    struct memphy_struct *mswp = swp_get_dev(swptyp);
+
+    if (mswp == NULL) return -1;
+    return __swap_cp_page(caller->mram, vicfpn, mswp, swpfpn);
 }
 
 /*get_vm_area_node - get vm area for a number of pages
@@ -114,26 +117,24 @@ struct vm_rg_struct *get_vm_area_node_at_brk(struct pcb_t *caller, int vmaid, in
  */
  int inc_vma_limit(struct pcb_t *caller, int vmaid, int inc_sz)
  {
-   struct vm_rg_struct * newrg = malloc(sizeof(struct vm_rg_struct));
    int inc_amt = PAGING_PAGE_ALIGNSZ(inc_sz);  // Căn chỉnh kích thước theo trang
-   int incnumpage =  inc_amt / PAGING_PAGESZ;  // Tính số trang cần cấp phát
    struct vm_rg_struct *region = get_vm_area_node_at_brk(caller, vmaid, inc_sz, PAGING_PAGESZ);
    struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
    if (region == NULL) return -1; // Không thể tạo vùng nhớ mới
 
-   int old_end = cur_vma->vm_end; // Lưu lại điểm cuối cũ của vùng nhớ
- 
-   if (validate_overlap_vm_area(caller, vmaid, region->rg_start, region->rg_end) == -1) return -1; // Trùng vùng nhớ, không cấp phát
- 
+   if (cur_vma == NULL ||
+       validate_overlap_vm_area(caller, vmaid, region->rg_start, region->rg_end) == -1) // Trùng vùng nhớ, không cấp phát
+   {
+     free(region);
+     return -1;
+   }
+   free(region);
+
+   // Chỉ giữ chỗ vùng nhớ ảo; frame vật lý được cấp ở lần chạm đầu tiên
+   // vào từng trang (lỗi trang nhỏ trong pg_getpage), nên không còn OOM lúc ALLOC
    cur_vma->vm_end += inc_amt;  // Mở rộng vùng nhớ của vma
    cur_vma->sbrk = cur_vma->vm_end; // Cập nhật điểm cuối heap mới sau khi tăng vm_end
- 
-   if (vm_map_ram(caller, region->rg_start, region->rg_end, 
-                     old_end, incnumpage , newrg) < 0){
-      free(newrg);
-      return -1; // Không thể ánh xạ vùng nhớ vào RAM
-   }
- 
+
    return 0;
  }
 
@@ -78,131 +78,171 @@ int pte_set_fpn(uint32_t *pte, int fpn)
 }
 
 /*
- * vmap_page_range - map a range of page at aligned address
+ * Two-level page table: mm->pgd is a directory of PAGING_PT_L1_SZ
+ * pointers to leaf tables of PAGING_PT_L2_SZ PTEs. A leaf is allocated
+ * (zeroed) the first time a page in its range gets a PTE, so an absent
+ * leaf stands for that many empty PTEs. Leaves stay until the mm is torn
+ * down, so a PTE pointer remains valid while mm->lock is held.
  */
- int vmap_page_range(struct pcb_t *caller,            // tiến trình gọi ánh xạ
-                      int addr,                       // địa chỉ bắt đầu đã được căn trang
-                      int pgnum,                      // số lượng trang cần ánh xạ
-                      struct framephy_struct *frames, // danh sách frame vật lý cần ánh xạ
-                      struct vm_rg_struct *ret_rg)    // trả lại vùng đã ánh xạ (thực tế)
+
+/*
+ * pte_lookup - find the PTE of a page
+ * @mm  : memory management struct
+ * @pgn : page number (PGN)
+ *
+ * Return NULL if the leaf table holding it was never allocated.
+ */
+uint32_t *pte_lookup(struct mm_struct *mm, int pgn)
 {
-  struct framephy_struct *fpit = frames;
-  int pgit = 0;
-  int pgn = PAGING_PGN(addr); // Chuyển địa chỉ thành số trang
-  int end_addr = addr + pgnum * PAGING_PAGESZ;  // Tính địa chỉ kết thúc của vùng ánh xạ
+  uint32_t *leaf;
 
-  // Cập nhật vùng nhớ đã ánh xạ (trả về qua ret_rg)
-  ret_rg->rg_end = end_addr;
-  ret_rg->rg_start = addr;
+  if (pgn < 0 || pgn >= PAGING_MAX_PGN)
+    return NULL;
 
-  // Ánh xạ từng frame vật lý vào bảng trang
-  for (pgit = 0; pgit < pgnum; pgit++){
-    if(fpit == NULL) return -1; // Không đủ frame để ánh xạ
+  leaf = mm->pgd[pgn >> PAGING_PT_L2_BITS];
+  if (leaf == NULL)
+    return NULL;
 
-    int curr_pgn = pgn + pgit; // Số trang hiện tại
+  return &leaf[pgn & (PAGING_PT_L2_SZ - 1)];
+}
 
-    // Gán frame number vào entry trong bảng trang
-    pte_set_fpn(&caller->mm->pgd[curr_pgn], fpit->fpn);
+/*
+ * pte_get - value of the PTE of a page, 0 if it has none
+ * @mm  : memory management struct
+ * @pgn : page number (PGN)
+ */
+uint32_t pte_get(struct mm_struct *mm, int pgn)
+{
+  uint32_t *pte = pte_lookup(mm, pgn);
 
-    // Đánh dấu trang là đang hiện diện và có thể ghi
-    // (đã được thực hiện bên trong pte_set_fpn hoặc có thể bổ sung thêm nếu cần)
+  return (pte != NULL) ? *pte : 0;
+}
 
-    // Thêm trang này vào hàng đợi FIFO để quản lý thay thế trang sau này
-    enlist_pgn_node(&caller->mm->fifo_pgn, curr_pgn);
+/*
+ * pte_alloc - find the PTE of a page, allocating its leaf table if needed
+ * @mm  : memory management struct
+ * @pgn : page number (PGN)
+ */
+uint32_t *pte_alloc(struct mm_struct *mm, int pgn)
+{
+  uint32_t **leaf;
+
+  if (pgn < 0 || pgn >= PAGING_MAX_PGN)
+    return NULL;
 
-    // Di chuyển đến frame tiếp theo
-    fpit = fpit->fp_next;
+  leaf = &mm->pgd[pgn >> PAGING_PT_L2_BITS];
+  if (*leaf == NULL)
+  {
+    *leaf = calloc(PAGING_PT_L2_SZ, sizeof(uint32_t));
+    if (*leaf == NULL)
+      return NULL;
   }
-  return 0; // Thành công
-}
 
+  return &(*leaf)[pgn & (PAGING_PT_L2_SZ - 1)];
+}
 
 /*
- * alloc_pages_range - allocate req_pgnum of frame in ram
- * @caller    : caller
- * @req_pgnum : request page num
- * @frm_lst   : frame list
+ * pte_next - first page from pgn on that has a non-empty PTE
+ * @mm  : memory management struct
+ * @pgn : page number (PGN) to start from
+ *
+ * Absent leaf tables are skipped whole. Return -1 past the last one.
  */
-
-int alloc_pages_range(struct pcb_t *caller, int req_pgnum, struct framephy_struct **frm_lst)
+int pte_next(struct mm_struct *mm, int pgn)
 {
-  int pgit, fpn;
-  struct framephy_struct *newfp_str = NULL;
+  uint32_t *leaf;
+
+  if (pgn < 0)
+    pgn = 0;
 
-  for (pgit = 0; pgit < req_pgnum; pgit++)
+  while (pgn < PAGING_MAX_PGN)
   {
-    // Cố gắng cấp phát một frame vật lý từ bộ nhớ chính
-    if (MEMPHY_get_freefp(caller->mram, &fpn) == 0)
+    leaf = mm->pgd[pgn >> PAGING_PT_L2_BITS];
+    if (leaf == NULL)
     {
-      // Cấp phát thành công, tạo struct framephy_struct tương ứng
-      newfp_str = malloc(sizeof(struct framephy_struct));
-      if (newfp_str == NULL) return -1; // Lỗi cấp phát bộ nhớ
-
-      newfp_str->owner = caller->mm;    // Gán chủ sở hữu là tiến trình hiện tại
-      newfp_str->fpn = fpn;             // Lưu số frame vật lý
-      newfp_str->fp_next = *frm_lst;    // Chèn vào đầu danh sách frame đã cấp phát
-      *frm_lst = newfp_str;
-    }
-    else
-    {
-      // Không còn đủ frame để cấp phát -> rollback lại các frame đã lấy
-      struct framephy_struct *curr = *frm_lst;
-      struct framephy_struct *next = NULL;
-
-      // Trả lại các frame đã cấp phát trước đó
-      while(curr != NULL){
-        next = curr->fp_next;
-        MEMPHY_put_freefp(caller->mram, curr->fpn); // Trả lại frame cho bộ nhớ
-        free(curr); // Giải phóng struct framephy_struct
-        curr = next;
-      }
-
-      return -3000; // Lỗi: không cấp phát đủ số lượng trang yêu cầu
+      pgn = ((pgn >> PAGING_PT_L2_BITS) + 1) << PAGING_PT_L2_BITS;
+      continue;
     }
+
+    if (leaf[pgn & (PAGING_PT_L2_SZ - 1)] != 0)
+      return pgn;
+    pgn++;
   }
 
-  return 0; // Thành công: đã cấp phát đủ số trang
+  return -1;
 }
 
 /*
- * vm_map_ram - do the mapping all vm are to ram storage device
- * @caller    : caller
- * @astart    : vm area start
- * @aend      : vm area end
- * @mapstart  : start mapping point
- * @incpgnum  : number of mapped page
- * @ret_rg    : returned region
+ * Software TLB: a small direct-mapped cache of pgn -> fpn kept in each
+ * mm_struct and used under mm->lock. An entry whose pgn is -1 is empty.
+ * Any path that moves a page out of its frame must invalidate it.
+ */
+
+/*
+ * tlb_flush - drop every cached translation of an mm
+ * @mm : memory management struct
  */
-int vm_map_ram(struct pcb_t *caller, int astart, int aend, int mapstart, int incpgnum, struct vm_rg_struct *ret_rg)
+int tlb_flush(struct mm_struct *mm)
 {
-  struct framephy_struct *frm_lst = NULL;
-  int ret_alloc;
-
-  /*@bksysnet: author provides a feasible solution of getting frames
-   *FATAL logic in here, wrong behaviour if we have not enough page
-   *i.e. we request 1000 frames meanwhile our RAM has size of 3 frames
-   *Don't try to perform that case in this simple work, it will result
-   *in endless procedure of swap-off to get frame and we have not provide
-   *duplicate control mechanism, keep it simple
-   */
-  ret_alloc = alloc_pages_range(caller, incpgnum, &frm_lst);
-
-  if (ret_alloc < 0 && ret_alloc != -3000)
-    return -1;
+  int i;
+
+  for (i = 0; i < PAGING_TLB_SZ; i++)
+    mm->tlb[i].pgn = -1;
+
+  return 0;
+}
+
+/*
+ * tlb_lookup - find the frame of a recently used page
+ * @mm  : memory management struct
+ * @pgn : page number (PGN)
+ * @fpn : return frame page number (FPN) on hit
+ * @pte : return the PTE of the page on hit, so a hit never walks the table
+ */
+int tlb_lookup(struct mm_struct *mm, int pgn, int *fpn, uint32_t **pte)
+{
+  struct tlb_entry_struct *ent = &mm->tlb[pgn % PAGING_TLB_SZ];
 
-  /* Out of memory */
-  if (ret_alloc == -3000)
+  if (ent->pgn != pgn)
   {
-#ifdef MMDBG
-    printf("OOM: vm_map_ram out of memory \n");
-#endif
+    mm->tlb_miss++;
     return -1;
   }
 
-  /* it leaves the case of memory is enough but half in ram, half in swap
-   * do the swaping all to swapper to get the all in ram */
-  vmap_page_range(caller, mapstart, incpgnum, frm_lst, ret_rg);
+  mm->tlb_hit++;
+  *fpn = ent->fpn;
+  *pte = ent->pte;
+  return 0;
+}
 
+/*
+ * tlb_insert - remember the translation pgn -> fpn
+ * @mm  : memory management struct
+ * @pgn : page number (PGN)
+ * @fpn : frame page number (FPN)
+ * @pte : PTE of the page
+ */
+int tlb_insert(struct mm_struct *mm, int pgn, int fpn, uint32_t *pte)
+{
+  struct tlb_entry_struct *ent = &mm->tlb[pgn % PAGING_TLB_SZ];
+
+  ent->pgn = pgn;
+  ent->fpn = fpn;
+  ent->pte = pte;
+  return 0;
+}
+
+/*
+ * tlb_invalidate - forget the translation of one page
+ * @mm  : memory management struct
+ * @pgn : page number (PGN)
+ */
+int tlb_invalidate(struct mm_struct *mm, int pgn)
+{
+  struct tlb_entry_struct *ent = &mm->tlb[pgn % PAGING_TLB_SZ];
+
+  if (ent->pgn == pgn)
+    ent->pgn = -1;
   return 0;
 }
 
@@ -215,17 +255,13 @@ int vm_map_ram(struct pcb_t *caller, int astart, int aend, int mapstart, int inc
 int __swap_cp_page(struct memphy_struct *mpsrc, int srcfpn,
                    struct memphy_struct *mpdst, int dstfpn)
 {
-  int cellidx;
-  int addrsrc, addrdst;
-  for (cellidx = 0; cellidx < PAGING_PAGESZ; cellidx++)
-  {
-    addrsrc = srcfpn * PAGING_PAGESZ + cellidx;
-    addrdst = dstfpn * PAGING_PAGESZ + cellidx;
+  BYTE page[PAGING_PAGESZ];
 
-    BYTE data;
-    MEMPHY_read(mpsrc, addrsrc, &data);
-    MEMPHY_write(mpdst, addrdst, data);
-  }
+  /* Chép nguyên frame một lần thay vì gọi MEMPHY_read/MEMPHY_write từng byte */
+  if (MEMPHY_read_page(mpsrc, srcfpn, page) != 0)
+    return -1;
+  if (MEMPHY_write_page(mpdst, dstfpn, page) != 0)
+    return -1;
 
   return 0;
 }
@@ -239,7 +275,8 @@ int init_mm(struct mm_struct *mm, struct pcb_t *caller)
 {
   struct vm_area_struct *vma0 = malloc(sizeof(struct vm_area_struct)); // Cấp phát VMA đầu tiên (vma_id = 0)
 
-  mm->pgd = malloc(PAGING_MAX_PGN * sizeof(uint32_t)); // Cấp phát bảng trang (page directory)
+  mm->pgd = calloc(PAGING_PT_L1_SZ, sizeof(uint32_t *)); // Thư mục trang rỗng, bảng lá chỉ cấp khi trang đầu tiên trong nó có PTE
+  pthread_mutex_init(&mm->lock, NULL); // Khoá riêng cho không gian nhớ của tiến trình
 
   /* Thiết lập thông tin cho VMA đầu tiên */
   vma0->vm_id = 0;
@@ -247,15 +284,15 @@ int init_mm(struct mm_struct *mm, struct pcb_t *caller)
   vma0->vm_end = vma0->vm_start;     // Vùng ban đầu chưa có gì
   vma0->sbrk = vma0->vm_start;       // Con trỏ break trỏ đến đầu vùng
 
-  // Khởi tạo danh sách vùng nhớ trống ban đầu (có thể rỗng nếu vm_start == vm_end)
-  struct vm_rg_struct *first_rg = init_vm_rg(vma0->vm_start, vma0->vm_end);
-  enlist_vm_rg_node(&vma0->vm_freerg_list, first_rg);
-
   vma0->vm_next = NULL;             // Chưa có VMA tiếp theo
   mm->mmap = vma0;                  // mmap trỏ đến VMA đầu tiên
   mm->mmap->vm_freerg_list = NULL;  // Ban đầu chưa có vùng nhớ trống thực tế
   mm->mmap->vm_next = NULL;         // Vẫn là VMA duy nhất
-  mm->fifo_pgn = NULL;              // Hàng đợi quản lý trang trống ban đầu
+  mm->fifo_head = -1;               // FIFO các trang có mặt trong RAM ban đầu rỗng
+  mm->fifo_tail = -1;
+  tlb_flush(mm);                    // TLB rỗng, chưa có bản dịch nào
+  mm->tlb_hit = 0;
+  mm->tlb_miss = 0;
 
   // Khởi tạo bảng ký hiệu (symbol region table) rỗng
   mm->symrgtbl[0].rg_start = 0;
@@ -266,6 +303,43 @@ int init_mm(struct mm_struct *mm, struct pcb_t *caller)
 
   return 0;
 }
+
+/*
+ * free_mm - release the bookkeeping of a Memory Management instance
+ * @mm: self mm, its frames and swap slots already returned
+ *      (free_pcb_memph)
+ */
+int free_mm(struct mm_struct *mm)
+{
+  struct vm_area_struct *vma, *nvma;
+  struct vm_rg_struct *rg, *nrg;
+  int i;
+
+  if (mm == NULL)
+    return -1;
+
+  // Các VMA cùng danh sách vùng trống của từng VMA
+  for (vma = mm->mmap; vma != NULL; vma = nvma)
+  {
+    nvma = vma->vm_next;
+    for (rg = vma->vm_freerg_list; rg != NULL; rg = nrg)
+    {
+      nrg = rg->rg_next;
+      free(rg);
+    }
+    free(vma);
+  }
+
+  // Chỉ các bảng lá đã được cấp, rồi tới thư mục trang
+  for (i = 0; i < PAGING_PT_L1_SZ; i++)
+    free(mm->pgd[i]);
+  free(mm->pgd);
+
+  pthread_mutex_destroy(&mm->lock);
+  free(mm);
+
+  return 0;
+}
  
 
 struct vm_rg_struct *init_vm_rg(int rg_start, int rg_end)
@@ -287,17 +361,6 @@ int enlist_vm_rg_node(struct vm_rg_struct **rglist, struct vm_rg_struct *rgnode)
   return 0;
 }
 
-int enlist_pgn_node(struct pgn_t **plist, int pgn)
-{
-  struct pgn_t *pnode = malloc(sizeof(struct pgn_t));
-
-  pnode->pgn = pgn;
-  pnode->pg_next = *plist;
-  *plist = pnode;
-
-  return 0;
-}
-
 int print_list_fp(struct framephy_struct *ifp)
 {
   struct framephy_struct *fp = ifp;
@@ -378,9 +441,11 @@ int print_pgtbl(struct pcb_t *caller, uint32_t start, uint32_t end)
   if (caller == NULL) { printf("NULL caller\n"); return -1;}
   printf("\n");
 
-  for (pgit = pgn_start; pgit < pgn_end; pgit++)
+  /* Only pages that have a PTE; absent leaf tables are skipped */
+  for (pgit = pte_next(caller->mm, pgn_start); pgit != -1 && pgit < pgn_end;
+       pgit = pte_next(caller->mm, pgit + 1))
   {
-    printf("%08ld: %08x\n", pgit * sizeof(uint32_t), caller->mm->pgd[pgit]);
+    printf("%08ld: %08x\n", pgit * sizeof(uint32_t), pte_get(caller->mm, pgit));
   }
 
   return 0;
@@ -18,6 +18,8 @@ static int done = 0;
 #ifdef MM_PAGING
 static int memramsz;
 static int memswpsz[PAGING_MAX_MMSWP];
+static char mmpolicy[16] = "fifo";
+static int mmwmark[2]; /* Low and high free frame watermarks */
 
 struct mmpaging_ld_args {
 	/* A dispatched argument struct to compact many-fields passing to loader */
@@ -48,6 +50,7 @@ struct cpu_args {
 static void * cpu_routine(void * args) {
 	struct timer_id_t * timer_id = ((struct cpu_args*)args)->timer_id;
 	int id = ((struct cpu_args*)args)->id;
+	sched_set_cpu(id);
 	/* Check for new process in ready queue */
 	int time_left = 0;
 	struct pcb_t * proc = NULL;
@@ -57,14 +60,23 @@ static void * cpu_routine(void * args) {
 			/* No process is running, the we load new process from
 		 	* ready queue */
 			proc = get_proc();
-			if (proc == NULL) {
-                           next_slot(timer_id);
-                           continue; /* First load failed. skip dummy load */
-                        }
-		}else if (proc->pc == proc->code->size) {
+			/* If it fails, fall through to the checks below so an
+			 * idle CPU still notices that loading is done */
+		}else if (__atomic_load_n(&proc->pc, __ATOMIC_RELAXED) == proc->code->size) {
 			/* The porcess has finish it job */
 			printf("\tCPU %d: Processed %2d has finished\n", id ,proc->pid);
-			dequeue_running(proc->running_list, proc);
+#if defined(MM_PAGING) && defined(MMDBG)
+			printf("\tPID %d TLB: %lu hits, %lu misses\n", proc->pid,
+				proc->mm->tlb_hit, proc->mm->tlb_miss);
+#endif
+			finish_proc(proc);
+#ifdef MM_PAGING
+			/* Give back frames, swap slots and the mm itself */
+			free_pcb_memph(proc);
+			free_mm(proc->mm);
+#endif
+			release_code(proc->code);
+			free(proc->page_table);
 			free(proc);
 			proc = NULL;
 			proc = get_proc();
@@ -85,7 +97,7 @@ static void * cpu_routine(void * args) {
 		}else if (proc == NULL) {
 			/* There may be new processes to run in
 			 * next time slots, just skip current slot */
-			next_slot(timer_id);
+			next_slot_idle(timer_id, TIMER_NO_WAKE);
 			continue;
 		}else if (time_left == 0) {
 			printf("\tCPU %d: Dispatched process %2d\n",
@@ -94,39 +106,143 @@ static void * cpu_routine(void * args) {
 		}
 		
 		/* Run current process */
+#ifdef CPU_BATCH
+		/* Run the whole quantum locally and meet the timer only at
+		 * its end, the clock still moves one slot per instruction */
+		int nrun = 0;
+		while (time_left > 0 &&
+		       __atomic_load_n(&proc->pc, __ATOMIC_RELAXED) < proc->code->size) {
+			run(proc);
+			time_left--;
+			nrun++;
+		}
+		next_slots(timer_id, nrun);
+#else
 		run(proc);
 		time_left--;
 		next_slot(timer_id);
+#endif
 	}
 	detach_event(timer_id);
 	pthread_exit(NULL);
 }
 
+#ifdef MM_PAGING
+/* Give a new process its own mm and the shared memory devices */
+static void ld_setup_mm(struct pcb_t * proc, struct mmpaging_ld_args * mm_args) {
+	proc->mm = malloc(sizeof(struct mm_struct));
+	init_mm(proc->mm, proc);
+	proc->mram = mm_args->mram;
+	proc->mswp = mm_args->mswp;
+	proc->active_mswp = mm_args->active_mswp;
+	proc->active_mswp_id = mm_args->active_mswp_id;
+}
+#endif
+
+#ifdef LOADER_PREFETCH
+/*
+ * Loader pipeline: worker threads load and prepare the PCBs (code, mm,
+ * page directory) in config order, up to LOADER_WINDOW processes ahead
+ * of admission. ld_routine() then only waits for each start time and
+ * hands the prepared PCB to the scheduler.
+ */
+#ifndef LOADER_WORKERS
+#define LOADER_WORKERS 4
+#endif
+#ifndef LOADER_WINDOW
+#define LOADER_WINDOW 64
+#endif
+
+static struct {
+	struct pcb_t ** proc;	/* Prepared PCB of process i, NULL until ready */
+	int next;		/* Next process to hand to a worker */
+	int admitted;		/* Processes already given to the scheduler */
+	pthread_mutex_t lock;
+	pthread_cond_t ready;	/* A PCB has been prepared */
+	pthread_cond_t room;	/* Admission has made room in the window */
+} ld_pipe;
+
+static void * ld_worker(void * args) {
+	struct pcb_t * proc;
+	int i;
+
+	while (1) {
+		pthread_mutex_lock(&ld_pipe.lock);
+		while (ld_pipe.next < num_processes &&
+		       ld_pipe.next >= ld_pipe.admitted + LOADER_WINDOW) {
+			pthread_cond_wait(&ld_pipe.room, &ld_pipe.lock);
+		}
+		i = ld_pipe.next++;
+		pthread_mutex_unlock(&ld_pipe.lock);
+		if (i >= num_processes) {
+			break;
+		}
+
+		/* PIDs follow the config order whatever worker gets there first */
+		proc = load_as(ld_processes.path[i], i + 1);
+#ifdef MLQ_SCHED
+		proc->prio = ld_processes.prio[i];
+#endif
+#ifdef MM_PAGING
+		ld_setup_mm(proc, (struct mmpaging_ld_args *)args);
+#endif
+		pthread_mutex_lock(&ld_pipe.lock);
+		ld_pipe.proc[i] = proc;
+		pthread_cond_broadcast(&ld_pipe.ready);
+		pthread_mutex_unlock(&ld_pipe.lock);
+	}
+	return NULL;
+}
+#endif
+
 static void * ld_routine(void * args) {
 #ifdef MM_PAGING
-	struct memphy_struct* mram = ((struct mmpaging_ld_args *)args)->mram;
-	struct memphy_struct** mswp = ((struct mmpaging_ld_args *)args)->mswp;
-	struct memphy_struct* active_mswp = ((struct mmpaging_ld_args *)args)->active_mswp;
-	struct timer_id_t * timer_id = ((struct mmpaging_ld_args *)args)->timer_id;
+	struct mmpaging_ld_args * mm_args = (struct mmpaging_ld_args *)args;
+	struct timer_id_t * timer_id = mm_args->timer_id;
 #else
 	struct timer_id_t * timer_id = (struct timer_id_t*)args;
 #endif
 	int i = 0;
 	printf("ld_routine\n");
+#ifdef LOADER_PREFETCH
+	pthread_t workers[LOADER_WORKERS];
+	int w;
+
+	ld_pipe.proc = (struct pcb_t **)calloc(num_processes, sizeof(struct pcb_t *));
+	ld_pipe.next = 0;
+	ld_pipe.admitted = 0;
+	pthread_mutex_init(&ld_pipe.lock, NULL);
+	pthread_cond_init(&ld_pipe.ready, NULL);
+	pthread_cond_init(&ld_pipe.room, NULL);
+	for (w = 0; w < LOADER_WORKERS; w++) {
+		pthread_create(&workers[w], NULL, ld_worker, args);
+	}
+#endif
 	while (i < num_processes) {
+#ifdef LOADER_PREFETCH
+		while (current_time() < ld_processes.start_time[i]) {
+			next_slot_idle(timer_id, ld_processes.start_time[i]);
+		}
+		/* Normally prepared long ago, only wait if the workers lag */
+		pthread_mutex_lock(&ld_pipe.lock);
+		while (ld_pipe.proc[i] == NULL) {
+			pthread_cond_wait(&ld_pipe.ready, &ld_pipe.lock);
+		}
+		struct pcb_t * proc = ld_pipe.proc[i];
+		ld_pipe.admitted = i + 1;
+		pthread_cond_broadcast(&ld_pipe.room);
+		pthread_mutex_unlock(&ld_pipe.lock);
+#else
 		struct pcb_t * proc = load(ld_processes.path[i]);
 #ifdef MLQ_SCHED
 		proc->prio = ld_processes.prio[i];
 #endif
 		while (current_time() < ld_processes.start_time[i]) {
-			next_slot(timer_id);
+			next_slot_idle(timer_id, ld_processes.start_time[i]);
 		}
 #ifdef MM_PAGING
-		proc->mm = malloc(sizeof(struct mm_struct));
-		init_mm(proc->mm, proc);
-		proc->mram = mram;
-		proc->mswp = mswp;
-		proc->active_mswp = active_mswp;
+		ld_setup_mm(proc, mm_args);
+#endif
 #endif
 		printf("\tLoaded a process at %s, PID: %d PRIO: %ld\n",
 			ld_processes.path[i], proc->pid, ld_processes.prio[i]);
@@ -135,6 +251,12 @@ static void * ld_routine(void * args) {
 		i++;
 		next_slot(timer_id);
 	}
+#ifdef LOADER_PREFETCH
+	for (w = 0; w < LOADER_WORKERS; w++) {
+		pthread_join(workers[w], NULL);
+	}
+	free(ld_pipe.proc);
+#endif
 	free(ld_processes.path);
 	free(ld_processes.start_time);
 	done = 1;
@@ -174,6 +296,17 @@ static void read_config(const char * path) {
 		fscanf(file, "%d", &(memswpsz[sit])); 
 
        fscanf(file, "\n"); /* Final character */
+
+	/* Optional page replacement policy on its own line, optionally
+	 * followed by the low and high free frame watermarks of reclaim:
+	 *        fifo | clock | lru | global  [LOW HIGH]
+	 * Process lines start with a digit, so older files still parse.
+	 */
+	if (fscanf(file, "%15[a-z]", mmpolicy) == 1) {
+		char line[64];
+		if (fgets(line, sizeof(line), file) != NULL)
+			sscanf(line, "%d %d", &mmwmark[0], &mmwmark[1]);
+	}
 #endif
 #endif
 
@@ -231,11 +364,32 @@ int main(int argc, char * argv[]) {
 
 	/* Create MEM RAM */
 	init_memphy(&mram, memramsz, rdmflag);
+	pgrep_init(&mram);
+	if (pgrep_set_policy(mmpolicy) != 0) {
+		printf("Unknown page replacement policy %s\n", mmpolicy);
+		exit(1);
+	}
+	if (pgrep_set_wmark(mmwmark[0], mmwmark[1]) != 0) {
+		printf("Invalid watermarks %d %d\n", mmwmark[0], mmwmark[1]);
+		exit(1);
+	}
 
         /* Create all MEM SWAP */ 
 	int sit;
+#ifdef MEMSWP_SEQ
+	/* Model the swap devices as tape-like sequential devices */
+	int swprdmflag = 0;
+#else
+	int swprdmflag = rdmflag;
+#endif
 	for(sit = 0; sit < PAGING_MAX_MMSWP; sit++)
-	       init_memphy(&mswp[sit], memswpsz[sit], rdmflag);
+	       init_memphy(&mswp[sit], memswpsz[sit], swprdmflag);
+
+	/* Swap slots are shared out over every non-empty device */
+	if (swp_init(mswp) != 0) {
+		printf("No usable MEMSWP device\n");
+		exit(1);
+	}
 
 	/* In Paging mode, it needs passing the system mem to each PCB through loader*/
 	struct mmpaging_ld_args *mm_ld_args = malloc(sizeof(struct mmpaging_ld_args));
@@ -248,7 +402,11 @@ int main(int argc, char * argv[]) {
 #endif
 
 	/* Init scheduler */
+#ifdef SCHED_PERCPU
+	init_scheduler_percpu(num_cpus);
+#else
 	init_scheduler();
+#endif
 
 	/* Run CPU and loader */
 #ifdef MM_PAGING
@@ -270,6 +428,18 @@ int main(int argc, char * argv[]) {
 	/* Stop timer */
 	stop_timer();
 
+#ifdef MM_PAGING
+	/* Report how far the heads of sequential devices travelled */
+	for (sit = 0; sit < PAGING_MAX_MMSWP; sit++) {
+		if (!mswp[sit].rdmflg && mswp[sit].maxsz > 0) {
+			printf("MEMSWP %d: seek distance %lu\n",
+				sit, MEMPHY_get_seekdist(&mswp[sit]));
+		}
+	}
+	swp_report();
+	pgrep_report();
+#endif
+
 	return 0;
 
 }
@@ -0,0 +1,25 @@
+/*
+ * Convert process descriptions from the text format to pre-compiled
+ * process images that load() maps without parsing
+ *
+ * Usage: proc2img [text process file] [image file]
+ */
+
+#include "loader.h"
+#include <stdio.h>
+
+int main(int argc, char * argv[]) {
+	if (argc != 3) {
+		printf("Usage: proc2img [text process file] [image file]\n");
+		return 1;
+	}
+
+	/* load() exits on unknown opcodes, so only valid programs get here */
+	struct pcb_t * proc = load(argv[1]);
+	if (save_image(argv[2], proc->code, proc->priority) < 0) {
+		printf("Cannot write process image at '%s'\n", argv[2]);
+		return 1;
+	}
+	printf("%s: %u instructions\n", argv[2], proc->code->size);
+	return 0;
+}
@@ -2,6 +2,13 @@
 #include <stdlib.h>
 #include "queue.h"
 
+/*
+ * queue_t là danh sách liên kết đôi dạng intrusive: mỗi pcb_t mang sẵn
+ * q_prev/q_next và q_owner (hàng đợi đang chứa nó), nên enqueue, dequeue
+ * và xoá một PCB đã biết đều là O(1), không cần dịch mảng như trước.
+ * Một PCB chỉ nằm trong tối đa một hàng đợi tại một thời điểm.
+ */
+
 int empty(struct queue_t * q) {
         if (q == NULL) return 1;
 	return (q->size == 0);
@@ -9,7 +16,7 @@ int empty(struct queue_t * q) {
 
 void enqueue(struct queue_t * q, struct pcb_t * proc) {
         if (proc == NULL  || q == NULL) return;
-        if (q->size >= MAX_QUEUE_SIZE) return;
+        if (proc->q_owner != NULL) return; /* Đang nằm trong hàng đợi khác */
 
         //Nếu sử dụng giải thuật MLQ thì ghi đè priority của process bằng prio
         #ifdef MLQ_SCHED
@@ -17,10 +24,37 @@ void enqueue(struct queue_t * q, struct pcb_t * proc) {
         #endif
 
         //Thêm process vào cuối hàng đợi, tương đương với việc proc tới sau sẽ được phục vụ sau
-        q->proc[q->size] = proc;
+        proc->q_next = NULL;
+        proc->q_prev = q->tail;
+        if (q->tail != NULL)
+                q->tail->q_next = proc;
+        else
+                q->head = proc;
+        q->tail = proc;
+        proc->q_owner = q;
         q->size++;
 }
 
+/*
+ * __unlink_proc - gỡ proc ra khỏi q, proc bắt buộc đang thuộc q
+ */
+static void __unlink_proc(struct queue_t * q, struct pcb_t * proc) {
+        if (proc->q_prev != NULL)
+                proc->q_prev->q_next = proc->q_next;
+        else
+                q->head = proc->q_next;
+
+        if (proc->q_next != NULL)
+                proc->q_next->q_prev = proc->q_prev;
+        else
+                q->tail = proc->q_prev;
+
+        proc->q_prev = NULL;
+        proc->q_next = NULL;
+        proc->q_owner = NULL;
+        q->size--;
+}
+
 struct pcb_t * dequeue(struct queue_t * q) {
         /* TODO: return a pcb whose prioprity is the highest
          * in the queue [q] and remember to remove it from q
@@ -28,32 +62,32 @@ struct pcb_t * dequeue(struct queue_t * q) {
         if (empty(q)) return NULL;
 
         //Lấy process đầu tiên ra khỏi hàng đợi và trả về process đó
-        struct pcb_t * proc = q->proc[0];
-        //Dịch các process phía sau lên một vị trí
-        for(int i = 0; i < q->size - 1; i++){
-                q->proc[i] = q->proc[i + 1];
-        }
-        q->proc[q->size-1] = NULL;
-        q->size--;
+        struct pcb_t * proc = q->head;
+        __unlink_proc(q, proc);
 
         return proc;
 }
 
 
 int dequeue_running(struct queue_t *q, struct pcb_t *proc) {
-	if (empty(q)) return -1;
-
-	for (int i = 0; i < q->size; i++) {
-			//Kiểm tra pid của process trong hàng đợi
-		if (q->proc[i] && q->proc[i]->pid == proc->pid) {
-			// Dịch các tiến trình phía sau lên một vị trí
-			for (int j = i; j < q->size - 1; j++) {
-				q->proc[j] = q->proc[j + 1];
-			}
-			q->proc[q->size - 1] = NULL;
-			q->size--;
-			return 0; // Đã xoá thành công
-		}
-	}
-	return -1; // Không tìm thấy
-}
\ No newline at end of file
+	if (empty(q) || proc == NULL) return -1;
+
+	//PCB tự biết hàng đợi chứa nó nên không cần duyệt tìm theo pid
+	if (proc->q_owner != q) return -1; // Không tìm thấy
+
+	__unlink_proc(q, proc);
+	return 0; // Đã xoá thành công
+}
+
+/*
+ * dequeue_tail - lấy process ở cuối hàng đợi (process mới vào nhất),
+ * dùng cho work stealing để không tranh phần đầu hàng đợi với CPU chủ
+ */
+struct pcb_t * dequeue_tail(struct queue_t * q) {
+	if (empty(q)) return NULL;
+
+	struct pcb_t * proc = q->tail;
+	__unlink_proc(q, proc);
+
+	return proc;
+}
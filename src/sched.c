@@ -5,23 +5,159 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 static struct queue_t ready_queue;
 static struct queue_t run_queue;
 static pthread_mutex_t queue_lock;
 
 static struct queue_t running_list;
 #ifdef MLQ_SCHED
+/*
+ *  Priority bitmaps: bit i of ready is set while mlq_ready_queue[i] holds
+ *  a process, bit i of budget while slot[i] > 0. The next queue to serve
+ *  is the lowest bit of (ready & budget), found with ctz instead of a
+ *  scan over all MAX_PRIO levels. Refilling the slots bumps an epoch and
+ *  slot[i] is reloaded on its next use, so a refill is O(1) as well.
+ */
+#define PRIO_BM_WORDS ((MAX_PRIO + 63) / 64)
+
+struct mlq_bm_t {
+	uint64_t ready[PRIO_BM_WORDS];
+	uint64_t budget[PRIO_BM_WORDS];
+	unsigned int epoch;
+	unsigned int slot_epoch[MAX_PRIO];
+};
+
+static inline void bm_set(uint64_t *bm, int i) {
+	bm[i >> 6] |= 1ULL << (i & 63);
+}
+
+static inline void bm_clr(uint64_t *bm, int i) {
+	bm[i >> 6] &= ~(1ULL << (i & 63));
+}
+
+/* Lowest bit set in a (and in b if given), -1 if none */
+static inline int bm_first(const uint64_t *a, const uint64_t *b) {
+	int w;
+	for (w = 0; w < PRIO_BM_WORDS; w++) {
+		uint64_t x = b ? (a[w] & b[w]) : a[w];
+		if (x)
+			return (w << 6) + __builtin_ctzll(x);
+	}
+	return -1;
+}
+
+static void bm_fill(uint64_t *bm) {
+	int w;
+	for (w = 0; w < PRIO_BM_WORDS; w++)
+		bm[w] = ~0ULL;
+	if (MAX_PRIO & 63)
+		bm[PRIO_BM_WORDS - 1] = (1ULL << (MAX_PRIO & 63)) - 1;
+}
+
+static void mlq_bm_refill(struct mlq_bm_t *bm) {
+	bm_fill(bm->budget);
+	bm->epoch++;
+}
+
+static void mlq_bm_init(struct mlq_bm_t *bm, int *slot) {
+	int i;
+	for (i = 0; i < PRIO_BM_WORDS; i++)
+		bm->ready[i] = 0;
+	for (i = 0; i < MAX_PRIO; i++) {
+		slot[i] = MAX_PRIO - i;
+		bm->slot_epoch[i] = 0;
+	}
+	bm_fill(bm->budget);
+	bm->epoch = 0;
+}
+
+static void mlq_add(struct queue_t *mlq, struct mlq_bm_t *bm, struct pcb_t *proc) {
+	enqueue(&mlq[proc->prio], proc);
+	bm_set(bm->ready, proc->prio);
+}
+
+/*
+ * mlq_pick - MLQ policy: serve the highest priority level that still has
+ * slot budget, refill every budget once no such level is left. A stale
+ * ready bit of an empty level is dropped here.
+ */
+static struct pcb_t * mlq_pick(struct queue_t *mlq, int *slot, struct mlq_bm_t *bm) {
+	struct pcb_t *proc;
+	int prio;
+
+	while (1) {
+		prio = bm_first(bm->ready, bm->budget);
+		if (prio < 0) {
+			mlq_bm_refill(bm);
+			prio = bm_first(bm->ready, NULL);
+			if (prio < 0)
+				return NULL;
+		}
+
+		proc = dequeue(&mlq[prio]);
+		if (empty(&mlq[prio]))
+			bm_clr(bm->ready, prio);
+		if (proc == NULL)
+			continue;
+
+		if (bm->slot_epoch[prio] != bm->epoch) {
+			slot[prio] = MAX_PRIO - prio;
+			bm->slot_epoch[prio] = bm->epoch;
+		}
+		if (--slot[prio] <= 0)
+			bm_clr(bm->budget, prio);
+		return proc;
+	}
+}
+
 static struct queue_t mlq_ready_queue[MAX_PRIO];
 static int slot[MAX_PRIO];
+static struct mlq_bm_t mlq_bm;
 #endif
 
+/*
+ * Helpers of sched_kill_by_name(), the caller holds the lock of the
+ * queues. Like before, only the first process whose path contains the
+ * name is hit in each queue.
+ */
+static struct pcb_t * kill_match(struct queue_t *q, const char *name) {
+	struct pcb_t *proc;
+
+	for (proc = q->head; proc != NULL; proc = proc->q_next)
+		if (strstr(proc->path, name))
+			return proc;
+	return NULL;
+}
+
+/* A running process is stopped by moving its PC to the end of its code,
+ * its CPU reads the PC atomically in run() */
+static void kill_running(struct queue_t *running, const char *name) {
+	struct pcb_t *proc = kill_match(running, name);
 
+	if (proc != NULL)
+		__atomic_store_n(&proc->pc, proc->code->size, __ATOMIC_RELAXED);
+}
+
+/* A ready process is unlinked and chained on *victims through q_next */
+static int kill_ready(struct queue_t *q, const char *name, struct pcb_t **victims) {
+	struct pcb_t *proc = kill_match(q, name);
+
+	if (proc == NULL)
+		return 0;
+	dequeue_running(q, proc);
+	proc->q_next = *victims;
+	*victims = proc;
+	return 1;
+}
+
+#ifndef SCHED_PERCPU
 int queue_empty(void) {
 #ifdef MLQ_SCHED
-	unsigned long prio;
-	for (prio = 0; prio < MAX_PRIO; prio++)
-		if(!empty(&mlq_ready_queue[prio])) 
-			return -1;
+	if (bm_first(mlq_bm.ready, NULL) >= 0)
+		return -1;
 #endif
 	return (empty(&ready_queue) && empty(&run_queue));
 }
@@ -31,16 +167,254 @@ void init_scheduler(void) {
     int i ;
 
 	for (i = 0; i < MAX_PRIO; i ++) {
+		mlq_ready_queue[i].head = mlq_ready_queue[i].tail = NULL;
 		mlq_ready_queue[i].size = 0;
-		slot[i] = MAX_PRIO - i; 
 	}
+	mlq_bm_init(&mlq_bm, slot);
 #endif
+	ready_queue.head = ready_queue.tail = NULL;
 	ready_queue.size = 0;
+	run_queue.head = run_queue.tail = NULL;
 	run_queue.size = 0;
+	running_list.head = running_list.tail = NULL;
+	running_list.size = 0;
 	pthread_mutex_init(&queue_lock, NULL);
 }
+#endif
+
+#ifdef SCHED_PERCPU
+#ifndef MLQ_SCHED
+#error "SCHED_PERCPU requires MLQ_SCHED"
+#endif
+/*
+ *  Per-CPU run queues: each CPU owns a full MLQ array, its own slot
+ *  budget and its own running list, protected by a per-CPU lock, so
+ *  get_proc()/put_proc() on different CPUs never contend. New processes
+ *  are spread round-robin over the CPUs and an idle CPU steals from the
+ *  tail of another CPU's queues.
+ */
+#ifndef MAX_CPU_RQ
+#define MAX_CPU_RQ 64
+#endif
+
+struct cpu_rq_t {
+	pthread_mutex_t lock;
+	struct queue_t mlq_ready_queue[MAX_PRIO];
+	int slot[MAX_PRIO];
+	struct mlq_bm_t bm;
+	struct queue_t running_list;
+	int nr_ready;	/* Tổng số process trong mlq_ready_queue, đọc không cần khoá */
+};
+
+static struct cpu_rq_t cpu_rq[MAX_CPU_RQ];
+static int nr_cpu_rq = 1;
+static unsigned int next_cpu_rq = 0;
+static __thread int this_cpu = 0;
+
+#define RQ_OF_RUNNING_LIST(q) \
+	((struct cpu_rq_t *)((char *)(q) - offsetof(struct cpu_rq_t, running_list)))
+
+void init_scheduler_percpu(int ncpus) {
+	int cpu, i;
+
+	if (ncpus < 1) ncpus = 1;
+	if (ncpus > MAX_CPU_RQ) ncpus = MAX_CPU_RQ;
+	nr_cpu_rq = ncpus;
+
+	for (cpu = 0; cpu < nr_cpu_rq; cpu++) {
+		struct cpu_rq_t *rq = &cpu_rq[cpu];
+		for (i = 0; i < MAX_PRIO; i++) {
+			rq->mlq_ready_queue[i].head = rq->mlq_ready_queue[i].tail = NULL;
+			rq->mlq_ready_queue[i].size = 0;
+		}
+		mlq_bm_init(&rq->bm, rq->slot);
+		rq->running_list.head = rq->running_list.tail = NULL;
+		rq->running_list.size = 0;
+		rq->nr_ready = 0;
+		pthread_mutex_init(&rq->lock, NULL);
+	}
+}
+
+void sched_set_cpu(int id) {
+	this_cpu = id % nr_cpu_rq;
+}
+
+int sched_nr_cpus(void) {
+	return nr_cpu_rq;
+}
+
+int queue_empty(void) {
+	int cpu;
+	for (cpu = 0; cpu < nr_cpu_rq; cpu++)
+		if (__atomic_load_n(&cpu_rq[cpu].nr_ready, __ATOMIC_RELAXED) > 0)
+			return -1;
+	return 1;
+}
+
+/* Must hold rq->lock */
+static void rq_enqueue(struct cpu_rq_t *rq, struct pcb_t *proc) {
+	proc->ready_queue = &ready_queue;
+	proc->mlq_ready_queue = rq->mlq_ready_queue;
+	proc->running_list = &rq->running_list;
+	mlq_add(rq->mlq_ready_queue, &rq->bm, proc);
+	__atomic_store_n(&rq->nr_ready, rq->nr_ready + 1, __ATOMIC_RELAXED);
+}
+
+/* Must hold rq->lock, same slot policy as get_mlq_proc() */
+static struct pcb_t * rq_pick(struct cpu_rq_t *rq) {
+	struct pcb_t *proc;
+
+	if (rq->nr_ready == 0)
+		return NULL;
+
+	proc = mlq_pick(rq->mlq_ready_queue, rq->slot, &rq->bm);
+	if (proc != NULL)
+		__atomic_store_n(&rq->nr_ready, rq->nr_ready - 1, __ATOMIC_RELAXED);
+	return proc;
+}
+
+/*
+ * rq_steal - take the newest process of the highest non-empty priority
+ * level of another CPU. Victims whose lock is busy are skipped instead
+ * of waited for.
+ */
+static struct pcb_t * rq_steal(int self) {
+	struct pcb_t *proc = NULL;
+	int n, prio;
+
+	for (n = 1; n < nr_cpu_rq && proc == NULL; n++) {
+		struct cpu_rq_t *victim = &cpu_rq[(self + n) % nr_cpu_rq];
+
+		if (__atomic_load_n(&victim->nr_ready, __ATOMIC_RELAXED) == 0)
+			continue;
+		if (pthread_mutex_trylock(&victim->lock) != 0)
+			continue;
+		while ((prio = bm_first(victim->bm.ready, NULL)) >= 0) {
+			proc = dequeue_tail(&victim->mlq_ready_queue[prio]);
+			if (empty(&victim->mlq_ready_queue[prio]))
+				bm_clr(victim->bm.ready, prio);
+			if (proc != NULL) {
+				__atomic_store_n(&victim->nr_ready, victim->nr_ready - 1, __ATOMIC_RELAXED);
+				break;
+			}
+		}
+		pthread_mutex_unlock(&victim->lock);
+	}
+	return proc;
+}
+
+struct pcb_t * get_proc(void) {
+	struct cpu_rq_t *rq = &cpu_rq[this_cpu];
+	struct pcb_t *proc;
+
+	pthread_mutex_lock(&rq->lock);
+	proc = rq_pick(rq);
+	pthread_mutex_unlock(&rq->lock);
+
+	if (proc == NULL)
+		proc = rq_steal(this_cpu);
+	if (proc == NULL)
+		return NULL;
+
+	/* Process (kể cả process lấy trộm) chạy trên CPU này từ bây giờ */
+	pthread_mutex_lock(&rq->lock);
+	proc->mlq_ready_queue = rq->mlq_ready_queue;
+	proc->running_list = &rq->running_list;
+	enqueue(&rq->running_list, proc);
+	pthread_mutex_unlock(&rq->lock);
+	return proc;
+}
+
+void put_proc(struct pcb_t * proc) {
+	struct cpu_rq_t *rq = RQ_OF_RUNNING_LIST(proc->running_list);
+
+	pthread_mutex_lock(&rq->lock);
+	dequeue_running(&rq->running_list, proc);
+	rq_enqueue(rq, proc);
+	pthread_mutex_unlock(&rq->lock);
+}
+
+void add_proc(struct pcb_t * proc) {
+	unsigned int cpu = __atomic_fetch_add(&next_cpu_rq, 1, __ATOMIC_RELAXED);
+	struct cpu_rq_t *rq = &cpu_rq[cpu % nr_cpu_rq];
+
+	pthread_mutex_lock(&rq->lock);
+	rq_enqueue(rq, proc);
+	pthread_mutex_unlock(&rq->lock);
+}
+
+/*
+ * finish_proc - drop a finished process from the running list of the
+ * CPU it ran on
+ */
+void finish_proc(struct pcb_t * proc) {
+	struct cpu_rq_t *rq = RQ_OF_RUNNING_LIST(proc->running_list);
+
+	pthread_mutex_lock(&rq->lock);
+	dequeue_running(&rq->running_list, proc);
+	pthread_mutex_unlock(&rq->lock);
+}
+
+/*
+ * sched_kill_by_name - stop the running processes and unlink the ready
+ * processes whose path contains name, on every CPU. Each run queue is
+ * only touched under its own lock. The unlinked processes are returned
+ * as a list chained through q_next; no CPU can reach them any more, so
+ * the caller frees them after the locks are dropped.
+ */
+struct pcb_t * sched_kill_by_name(const char *name) {
+	struct pcb_t *victims = NULL;
+	int cpu, prio;
+
+	for (cpu = 0; cpu < nr_cpu_rq; cpu++) {
+		struct cpu_rq_t *rq = &cpu_rq[cpu];
+
+		pthread_mutex_lock(&rq->lock);
+		kill_running(&rq->running_list, name);
+		for (prio = 0; prio < MAX_PRIO; prio++) {
+			if (!kill_ready(&rq->mlq_ready_queue[prio], name, &victims))
+				continue;
+			if (empty(&rq->mlq_ready_queue[prio]))
+				bm_clr(rq->bm.ready, prio);
+			__atomic_store_n(&rq->nr_ready, rq->nr_ready - 1, __ATOMIC_RELAXED);
+		}
+		pthread_mutex_unlock(&rq->lock);
+	}
+	return victims;
+}
+#else
+void sched_set_cpu(int id) {
+	/* Global queues: every CPU shares the same run queue */
+	(void)id;
+}
 
+void finish_proc(struct pcb_t * proc) {
+	pthread_mutex_lock(&queue_lock);
+	dequeue_running(proc->running_list, proc);
+	pthread_mutex_unlock(&queue_lock);
+}
+
+/* Same as the per-CPU version, over the global queues */
+struct pcb_t * sched_kill_by_name(const char *name) {
+	struct pcb_t *victims = NULL;
+
+	pthread_mutex_lock(&queue_lock);
+	kill_running(&running_list, name);
 #ifdef MLQ_SCHED
+	int prio;
+	for (prio = 0; prio < MAX_PRIO; prio++)
+		if (kill_ready(&mlq_ready_queue[prio], name, &victims)
+		    && empty(&mlq_ready_queue[prio]))
+			bm_clr(mlq_bm.ready, prio);
+#else
+	kill_ready(&ready_queue, name, &victims);
+#endif
+	pthread_mutex_unlock(&queue_lock);
+	return victims;
+}
+#endif
+
+#if defined(MLQ_SCHED) && !defined(SCHED_PERCPU)
 /* 
  *  Stateful design for routine calling
  *  based on the priority and our MLQ policy
@@ -50,39 +424,24 @@ void init_scheduler(void) {
 struct pcb_t * get_mlq_proc(void) {
 	struct pcb_t * proc = NULL;
 	pthread_mutex_lock(&queue_lock);
-	// Chạy tối đa 2 lần: lần 1 dùng slot, lần 2 sau khi reset
-	for (int attempt = 0; attempt < 2; attempt++) {
-		for (int i = 0; i < MAX_PRIO; i++) {
-			if (slot[i] > 0 && !empty(&mlq_ready_queue[i])) {
-				proc = dequeue(&mlq_ready_queue[i]);
-				if (proc != NULL) {
-					enqueue(&running_list, proc);
-					slot[i]--;
-					pthread_mutex_unlock(&queue_lock);
-					return proc;
-				}
-			}
-		}
-		 // Nếu không dequeue được process nào, reset lại slot và thử lại
-		for (int i = 0; i < MAX_PRIO; i++) {
-			slot[i] = MAX_PRIO - i;
-		}
-	}
+	proc = mlq_pick(mlq_ready_queue, slot, &mlq_bm);
+	if (proc != NULL)
+		enqueue(&running_list, proc);
 	pthread_mutex_unlock(&queue_lock);
-	return NULL;
+	return proc;
 }
 
 void put_mlq_proc(struct pcb_t * proc) {
 	pthread_mutex_lock(&queue_lock);
-	enqueue(&mlq_ready_queue[proc->prio], proc);
 	dequeue_running(&running_list, proc);
+	mlq_add(mlq_ready_queue, &mlq_bm, proc);
 	pthread_mutex_unlock(&queue_lock);
 }
 
 void add_mlq_proc(struct pcb_t * proc) {
 	pthread_mutex_lock(&queue_lock);
-	enqueue(&mlq_ready_queue[proc->prio], proc);
 	dequeue_running(&running_list, proc);
+	mlq_add(mlq_ready_queue, &mlq_bm, proc);
 	pthread_mutex_unlock(&queue_lock);	
 }
 
@@ -105,7 +464,7 @@ void add_proc(struct pcb_t * proc) {
 	/* TODO: put running proc to running_list */
 	return add_mlq_proc(proc);
 }
-#else
+#elif !defined(SCHED_PERCPU)
 struct pcb_t * get_proc(void) {
 	struct pcb_t * proc = NULL;
 	/*TODO: get a process from [ready_queue].
@@ -127,8 +486,8 @@ void put_proc(struct pcb_t * proc) {
 	/* TODO: put running proc to running_list */
 
 	pthread_mutex_lock(&queue_lock);
-	enqueue(&ready_queue, proc);
 	dequeue_running(&running_list, proc);
+	enqueue(&ready_queue, proc);
 	pthread_mutex_unlock(&queue_lock);
 }
 
@@ -139,8 +498,8 @@ void add_proc(struct pcb_t * proc) {
 	/* TODO: put running proc to running_list */
 
 	pthread_mutex_lock(&queue_lock);
-	enqueue(&ready_queue, proc);
 	dequeue_running(&running_list, proc);
+	enqueue(&ready_queue, proc);
 	pthread_mutex_unlock(&queue_lock);	
 }
 #endif
@@ -0,0 +1,125 @@
+/*
+ * Dispatch micro-benchmark for the MLQ scheduler
+ * Build with -DMLQ_SCHED and link against sched.c and queue.c
+ *
+ * Usage: sched_bench [number of processes] [number of dispatches]
+ *
+ * Runs the same get_proc()/put_proc() workload through sched.c (priority
+ * bitmap) and through a copy of the former linear MAX_PRIO scan, both
+ * under a lock and with the running list update, checks that both
+ * dispatch the processes in the same order and prints the average
+ * latency of one dispatch.
+ */
+
+#include "queue.h"
+#include "sched.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#if !defined(MLQ_SCHED) || defined(SCHED_PERCPU)
+#error "sched_bench requires MLQ_SCHED with the global run queue"
+#endif
+
+static struct queue_t scan_queue[MAX_PRIO];
+static struct queue_t scan_running;
+static int scan_slot[MAX_PRIO];
+static pthread_mutex_t scan_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The dispatch loop get_mlq_proc() used before the priority bitmap */
+static struct pcb_t * scan_get_proc(void) {
+	struct pcb_t * proc;
+	pthread_mutex_lock(&scan_lock);
+	for (int attempt = 0; attempt < 2; attempt++) {
+		for (int i = 0; i < MAX_PRIO; i++) {
+			if (scan_slot[i] > 0 && !empty(&scan_queue[i])) {
+				proc = dequeue(&scan_queue[i]);
+				enqueue(&scan_running, proc);
+				scan_slot[i]--;
+				pthread_mutex_unlock(&scan_lock);
+				return proc;
+			}
+		}
+		for (int i = 0; i < MAX_PRIO; i++)
+			scan_slot[i] = MAX_PRIO - i;
+	}
+	pthread_mutex_unlock(&scan_lock);
+	return NULL;
+}
+
+static void scan_put_proc(struct pcb_t * proc) {
+	pthread_mutex_lock(&scan_lock);
+	dequeue_running(&scan_running, proc);
+	enqueue(&scan_queue[proc->prio], proc);
+	pthread_mutex_unlock(&scan_lock);
+}
+
+static double now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static struct pcb_t * new_procs(int nproc) {
+	struct pcb_t * procs = calloc(nproc, sizeof(struct pcb_t));
+	for (int i = 0; i < nproc; i++) {
+		procs[i].pid = i + 1;
+		/* Sparse priorities, mostly in the low levels */
+		procs[i].prio = (i * 37) % MAX_PRIO;
+	}
+	return procs;
+}
+
+int main(int argc, char * argv[]) {
+	int nproc = (argc > 1) ? atoi(argv[1]) : 8;
+	long ndisp = (argc > 2) ? atol(argv[2]) : 1000000;
+	struct pcb_t * procs, * ref, * proc;
+	uint32_t * order;
+	double t0, t_scan, t_bm;
+	long i;
+
+	if (nproc < 1 || ndisp < 1) {
+		fprintf(stderr, "Usage: %s [number of processes] [number of dispatches]\n", argv[0]);
+		return 1;
+	}
+
+	procs = new_procs(nproc);
+	ref = new_procs(nproc);
+	order = malloc(sizeof(uint32_t) * ndisp);
+
+	/* Linear scan */
+	for (i = 0; i < MAX_PRIO; i++)
+		scan_slot[i] = MAX_PRIO - i;
+	for (i = 0; i < nproc; i++)
+		enqueue(&scan_queue[ref[i].prio], &ref[i]);
+	t0 = now_ns();
+	for (i = 0; i < ndisp; i++) {
+		proc = scan_get_proc();
+		order[i] = proc->pid;
+		scan_put_proc(proc);
+	}
+	t_scan = (now_ns() - t0) / ndisp;
+
+	/* Priority bitmap */
+	init_scheduler();
+	for (i = 0; i < nproc; i++)
+		add_proc(&procs[i]);
+	t0 = now_ns();
+	for (i = 0; i < ndisp; i++) {
+		proc = get_proc();
+		if (proc->pid != order[i]) {
+			printf("Dispatch %ld differs: scan pid %u, bitmap pid %u\n",
+				i, order[i], proc->pid);
+			return 1;
+		}
+		put_proc(proc);
+	}
+	t_bm = (now_ns() - t0) / ndisp;
+
+	printf("%d processes, %ld dispatches, MAX_PRIO %d\n", nproc, ndisp, MAX_PRIO);
+	printf("linear scan : %8.1f ns/dispatch\n", t_scan);
+	printf("bitmap      : %8.1f ns/dispatch\n", t_bm);
+	return 0;
+}
@@ -12,59 +12,56 @@
 #include "syscall.h"
 #include "stdio.h"
 #include "libmem.h"
+#include "mm.h"
 #include "string.h"
 #include "stdlib.h"
 #include "queue.h"
+#include "sched.h"
+#include "loader.h"
 
 int __sys_killall(struct pcb_t *caller, struct sc_regs* regs)
 {
     char proc_name[100];
-    uint32_t data;
 
     // Lấy ID vùng nhớ chứa tên tiến trình mục tiêu (demo, hardcoded)
     uint32_t memrg = regs->a1;
 
-    /* Đọc tên tiến trình từ vùng nhớ do tiến trình gọi syscall cung cấp */
-    int i = 0;
-    data = 0;
-    while (data != -1) {
-        libread(caller, memrg, i, &data);  // Đọc từng byte từ vùng nhớ được chỉ định
-        proc_name[i] = data;
-        if (data == -1) proc_name[i] = '\0';  // Kết thúc chuỗi khi gặp -1
-        i++;
-    }
-    printf("The procname retrieved from memregionid %d is \"%s\"\n", memrg, proc_name);
-
-    /* Duyệt danh sách các tiến trình đang chạy và tìm tiến trình có tên khớp */
-    struct queue_t *run_list = caller->running_list;
+    /* Đọc cả tên tiến trình trong một lần đọc khối thay vì từng byte,
+     * tên kết thúc ở byte -1 hoặc ở cuối vùng nhớ */
+    struct vm_rg_struct *rg = get_symrg_byid(caller->mm, memrg);
+    if (rg == NULL || rg->rg_end <= rg->rg_start)
+        return -1; // Vùng không tồn tại hoặc rỗng thì không có tên nào để giết
 
-    for (int i = 0; i < run_list->size; i++) {
-        struct pcb_t *curr_proc_r = run_list->proc[i];
-        
-        if (curr_proc_r == NULL) continue;
-
-        // Nếu tên tiến trình chứa proc_name thì "dừng" nó bằng cách đặt PC về cuối code
-        if (strstr(curr_proc_r->path, proc_name)) {
-            curr_proc_r->pc = curr_proc_r->code->size;  // Dừng tiến trình
+    uint32_t len = rg->rg_end - rg->rg_start;
+    if (len > sizeof(proc_name) - 1) len = sizeof(proc_name) - 1;
+    if (libread_range(caller, memrg, 0, (BYTE *)proc_name, len) != 0)
+        return -1;
+    proc_name[len] = '\0';
+    for (uint32_t i = 0; i < len; i++) {
+        // So sánh dạng unsigned để byte 0xFF được nhận ra dù char có dấu hay không
+        if ((unsigned char)proc_name[i] == 0xFF) {
+            proc_name[i] = '\0';
             break;
         }
     }
+    printf("The procname retrieved from memregionid %d is \"%s\"\n", memrg, proc_name);
 
-    /* Duyệt các hàng đợi và xóa tiến trình khớp tên */
-    for (int i = 0; i < MAX_PRIO; i++) {
-        struct queue_t *ready_list = &caller->mlq_ready_queue[i];
-        for (int j = 0; j < ready_list->size; j++) {
-            struct pcb_t *curr_proc_rdq = ready_list->proc[j];
+    // Tên rỗng khớp với mọi đường dẫn (strstr), tuyệt đối không đem đi so
+    if (proc_name[0] == '\0')
+        return -1;
 
-            if (curr_proc_rdq == NULL || curr_proc_rdq->path == NULL) continue;
+    /* Scheduler dừng/gỡ tiến trình khớp tên dưới khoá của từng hàng đợi,
+     * các tiến trình bị gỡ chỉ được giải phóng sau khi đã nhả khoá */
+    struct pcb_t *victim = sched_kill_by_name(proc_name);
+    while (victim != NULL) {
+        struct pcb_t *next = victim->q_next;
 
-            // Nếu tên khớp thì loại khỏi hàng đợi và giải phóng tiến trình
-            if (strstr(curr_proc_rdq->path, proc_name)) {
-                dequeue_running(ready_list, curr_proc_rdq);
-                free(curr_proc_rdq);
-                break;
-            }
-        }
+        free_pcb_memph(victim); // Trả frame, slot swap và mm của tiến trình
+        free_mm(victim->mm);
+        release_code(victim->code);
+        free(victim->page_table);
+        free(victim);
+        victim = next;
     }
     return 0;
 }
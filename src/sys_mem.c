@@ -31,7 +31,7 @@ int __sys_memmap(struct pcb_t *caller, struct sc_regs* regs)
             break;
    case SYSMEM_SWP_OP:
             // Thực hiện thao tác hoán đổi trang bộ nhớ
-            if (__mm_swap_page(caller, regs->a2, regs->a3) == -1) return -1; // Nếu thất bại, trả về -1
+            if (__mm_swap_page(caller, regs->a2, regs->a4, regs->a3) == -1) return -1; // Nếu thất bại, trả về -1
             break;
    case SYSMEM_IO_READ:
             // Đọc giá trị từ bộ nhớ vật lý (IO Read)
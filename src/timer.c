@@ -8,6 +8,9 @@ static pthread_t _timer;
 struct timer_id_container_t {
 	struct timer_id_t id;
 	struct timer_id_container_t * next;
+	int idle;	/* Device has nothing to do before [wake] */
+	uint64_t wake;
+	uint64_t until;	/* Device is done with every slot before [until] */
 };
 
 static struct timer_id_container_t * dev_list = NULL;
@@ -17,12 +20,191 @@ static uint64_t _time;
 static int timer_started = 0;
 static int timer_stop = 0;
 
+#ifdef TIMER_FASTFWD
+/*
+ *  Fast-forward (build with -DTIMER_FASTFWD)
+ *  When every device still attached is idle, nothing can happen before
+ *  the earliest wake time they announced through next_slot_idle(), so the
+ *  clock jumps there directly. The skipped slots are still printed to
+ *  keep the log identical to a slot-by-slot run.
+ */
+static void timer_fast_forward(uint64_t wake) {
+	if (wake == TIMER_NO_WAKE)
+		return;
+	while (_time + 1 < wake) {
+		_time++;
+		printf("Time slot %3lu\n", current_time());
+	}
+}
+#endif
+
+#ifdef TIMER_BARRIER
+/*
+ *  Barrier timer backend (build with -DTIMER_BARRIER)
+ *  All devices share one atomic word: active devices in the high half,
+ *  devices that have arrived in the current slot in the low half. A
+ *  device arrives with one atomic add; the last one to arrive moves the
+ *  clock and bumps the generation the others are waiting on. Waiters spin
+ *  briefly on the generation and only then sleep on a single condvar, so
+ *  the per-device mutex/condvar round-trips of the default backend are
+ *  gone from the common path.
+ */
+#define TIMER_SPIN 4000
+
+static uint64_t barrier_state;
+static unsigned int barrier_gen;
+static int barrier_sleepers;
+static int barrier_finished;
+static uint32_t barrier_idle;
+static uint32_t barrier_parked;
+static uint64_t barrier_wake = TIMER_NO_WAKE;
+static pthread_mutex_t barrier_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t barrier_cond = PTHREAD_COND_INITIALIZER;
+
+#define BARRIER_ACTIVE(s)	((uint32_t)((s) >> 32))
+#define BARRIER_ARRIVED(s)	((uint32_t)(s))
+#define BARRIER_ONE_DEV		((uint64_t)1 << 32)
+
+static void barrier_broadcast(void) {
+	pthread_mutex_lock(&barrier_lock);
+	pthread_cond_broadcast(&barrier_cond);
+	pthread_mutex_unlock(&barrier_lock);
+}
+
+/* Run by the last device to arrive, every other active device is waiting */
+static void barrier_tick(uint32_t active) {
+	uint32_t parked = 0;
+
+#ifdef TIMER_FASTFWD
+	if (barrier_idle == active)
+		timer_fast_forward(barrier_wake);
+	barrier_idle = 0;
+	barrier_wake = TIMER_NO_WAKE;
+#endif
+	/* Devices inside next_slots() count as arrived until their last
+	 * slot. If that is every active device, nobody is left to arrive
+	 * and the clock has to move on by itself. */
+	do {
+		_time++;
+		printf("Time slot %3lu\n", current_time());
+
+		parked = 0;
+		if (barrier_parked > 0) {
+			struct timer_id_container_t * temp;
+			for (temp = dev_list; temp != NULL; temp = temp->next) {
+				if (temp->until > _time) {
+					parked++;
+				}else if (temp->until != 0) {
+					temp->until = 0;
+					__atomic_sub_fetch(&barrier_parked, 1, __ATOMIC_RELAXED);
+				}
+			}
+		}
+	} while (parked == active);
+	__atomic_store_n(&barrier_state, ((uint64_t)active << 32) | parked,
+			 __ATOMIC_RELAXED);
+	__atomic_add_fetch(&barrier_gen, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&barrier_sleepers, __ATOMIC_SEQ_CST) > 0)
+		barrier_broadcast();
+}
+
+static void barrier_wait(unsigned int gen) {
+	int spin;
+
+	for (spin = 0; spin < TIMER_SPIN; spin++)
+		if (__atomic_load_n(&barrier_gen, __ATOMIC_ACQUIRE) != gen)
+			return;
+
+	pthread_mutex_lock(&barrier_lock);
+	__atomic_add_fetch(&barrier_sleepers, 1, __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(&barrier_gen, __ATOMIC_SEQ_CST) == gen)
+		pthread_cond_wait(&barrier_cond, &barrier_lock);
+	__atomic_sub_fetch(&barrier_sleepers, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&barrier_lock);
+}
+
+static void * timer_routine(void * args) {
+	/* Slots are driven by the devices, just wait until all have left */
+	pthread_mutex_lock(&barrier_lock);
+	while (!barrier_finished)
+		pthread_cond_wait(&barrier_cond, &barrier_lock);
+	pthread_mutex_unlock(&barrier_lock);
+	pthread_exit(args);
+}
+
+void next_slot(struct timer_id_t * timer_id) {
+	unsigned int gen = __atomic_load_n(&barrier_gen, __ATOMIC_ACQUIRE);
+	uint64_t state = __atomic_add_fetch(&barrier_state, 1, __ATOMIC_ACQ_REL);
+
+	if (BARRIER_ARRIVED(state) == BARRIER_ACTIVE(state))
+		barrier_tick(BARRIER_ACTIVE(state));
+	else
+		barrier_wait(gen);
+}
+
+void next_slots(struct timer_id_t * timer_id, uint64_t nslots) {
+	struct timer_id_container_t * dev =
+		(struct timer_id_container_t *)timer_id;
+	uint64_t until = current_time() + nslots;
+	unsigned int gen;
+
+	if (nslots <= 1) {
+		next_slot(timer_id);
+		return;
+	}
+
+	/* Published by the release ordering of the arrival below */
+	dev->until = until;
+	__atomic_add_fetch(&barrier_parked, 1, __ATOMIC_RELAXED);
+	next_slot(timer_id);
 
+	while (1) {
+		gen = __atomic_load_n(&barrier_gen, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&_time, __ATOMIC_SEQ_CST) >= until)
+			break;
+		barrier_wait(gen);
+	}
+}
+
+void next_slot_idle(struct timer_id_t * timer_id, uint64_t wake_time) {
+#ifdef TIMER_FASTFWD
+	uint64_t cur = __atomic_load_n(&barrier_wake, __ATOMIC_RELAXED);
+
+	while (wake_time < cur &&
+	       !__atomic_compare_exchange_n(&barrier_wake, &cur, wake_time, 0,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+	__atomic_add_fetch(&barrier_idle, 1, __ATOMIC_RELAXED);
+#endif
+	next_slot(timer_id);
+}
+
+void detach_event(struct timer_id_t * event) {
+	uint64_t state;
+
+	if (event->fsh)
+		return;
+	event->fsh = 1;
+
+	state = __atomic_sub_fetch(&barrier_state, BARRIER_ONE_DEV, __ATOMIC_ACQ_REL);
+	if (BARRIER_ACTIVE(state) == 0) {
+		pthread_mutex_lock(&barrier_lock);
+		barrier_finished = 1;
+		pthread_cond_broadcast(&barrier_cond);
+		pthread_mutex_unlock(&barrier_lock);
+	} else if (BARRIER_ARRIVED(state) == BARRIER_ACTIVE(state)) {
+		/* Everybody else was only waiting for us */
+		barrier_tick(BARRIER_ACTIVE(state));
+	}
+}
+#else
 static void * timer_routine(void * args) {
 	while (!timer_stop) {
 		printf("Time slot %3lu\n", current_time());/////////////////////
 		int fsh = 0;
 		int event = 0;
+		int idle = 0;
+		uint64_t wake = TIMER_NO_WAKE;
 		/* Wait for all devices have done the job in current
 		 * time slot */
 		struct timer_id_container_t * temp;
@@ -36,16 +218,29 @@ static void * timer_routine(void * args) {
 			}
 			if (temp->id.fsh) {
 				fsh++;
+			}else if (temp->idle) {
+				idle++;
+				if (temp->wake < wake)
+					wake = temp->wake;
 			}
 			event++;
 			pthread_mutex_unlock(&temp->id.event_lock);
 		}
 
+#ifdef TIMER_FASTFWD
+		if (fsh + idle == event) {
+			timer_fast_forward(wake);
+		}
+#endif
 		/* Increase the time slot */
 		_time++;
 		
-		/* Let devices continue their job */
+		/* Let devices continue their job, a device inside
+		 * next_slots() stays done until its last slot */
 		for (temp = dev_list; temp != NULL; temp = temp->next) {
+			if (temp->until > _time) {
+				continue;
+			}
 			pthread_mutex_lock(&temp->id.timer_lock);
 			temp->id.done = 0;
 			pthread_cond_signal(&temp->id.timer_cond);
@@ -76,13 +271,24 @@ void next_slot(struct timer_id_t * timer_id) {
 	pthread_mutex_unlock(&timer_id->timer_lock);
 }
 
-uint64_t current_time() {
-	return _time;
+void next_slots(struct timer_id_t * timer_id, uint64_t nslots) {
+	struct timer_id_container_t * dev =
+		(struct timer_id_container_t *)timer_id;
+
+	/* Published to the timer by the locked done=1 in next_slot() */
+	dev->until = current_time() + nslots;
+	next_slot(timer_id);
 }
 
-void start_timer() {
-	timer_started = 1;
-	pthread_create(&_timer, NULL, timer_routine, NULL);
+void next_slot_idle(struct timer_id_t * timer_id, uint64_t wake_time) {
+	struct timer_id_container_t * dev =
+		(struct timer_id_container_t *)timer_id;
+
+	/* Published to the timer by the locked done=1 in next_slot() */
+	dev->idle = 1;
+	dev->wake = wake_time;
+	next_slot(timer_id);
+	dev->idle = 0;
 }
 
 void detach_event(struct timer_id_t * event) {
@@ -91,6 +297,19 @@ void detach_event(struct timer_id_t * event) {
 	pthread_cond_signal(&event->event_cond);
 	pthread_mutex_unlock(&event->event_lock);
 }
+#endif
+
+uint64_t current_time() {
+	return _time;
+}
+
+void start_timer() {
+	timer_started = 1;
+#ifdef TIMER_BARRIER
+	printf("Time slot %3lu\n", current_time());
+#endif
+	pthread_create(&_timer, NULL, timer_routine, NULL);
+}
 
 struct timer_id_t * attach_event() {
 	if (timer_started) {
@@ -102,10 +321,16 @@ struct timer_id_t * attach_event() {
 			);
 		container->id.done = 0;
 		container->id.fsh = 0;
+		container->idle = 0;
+		container->wake = TIMER_NO_WAKE;
+		container->until = 0;
 		pthread_cond_init(&container->id.event_cond, NULL);
 		pthread_mutex_init(&container->id.event_lock, NULL);
 		pthread_cond_init(&container->id.timer_cond, NULL);
 		pthread_mutex_init(&container->id.timer_lock, NULL);
+#ifdef TIMER_BARRIER
+		barrier_state += BARRIER_ONE_DEV;
+#endif
 		if (dev_list == NULL) {
 			dev_list = container;
 			dev_list->next = NULL;